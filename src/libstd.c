@@ -4,19 +4,149 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include "efi.h"
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-int putchar(char c);
 int snprintf(char* buffer, size_t n, const char* format, ...);
+int console_write(const char* s, size_t n);
+
+extern EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* cout;
 
 
 /*********************************************************************/
 
 
+//  Blocks at least this long go to rep movs/stos on x86, shorter ones are not worth their startup
+#define MEM_REP_MIN 64
+
+//  Unaligned word, for the loops below
+typedef uintptr_t __attribute__((__may_alias__, __aligned__(1))) mem_word;
+typedef uintptr_t __attribute__((__may_alias__)) mem_aligned_word;
+
+//  Bytes of 0x01 and 0x80 in a word
+#define MEM_ONES (UINTPTR_MAX / 0xFF)
+#define MEM_HIGHS (MEM_ONES << 7)
+
+//  0x80 in the first zero byte of w, so the index is in its trailing zeros (little endian)
+static uintptr_t mem_zero_bytes(uintptr_t w) {
+    return (w - MEM_ONES) & ~w & MEM_HIGHS;
+}
+
+static size_t mem_first_byte(uintptr_t mask) {
+#if UINTPTR_MAX > UINT32_MAX
+    return __builtin_ctzll(mask) >> 3;
+#else
+    return __builtin_ctz(mask) >> 3;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+//  SSE2 and NEON are always there, through the vector extension as glyph-x64.c does
+#define MEM_VECTOR_SIZE 16
+typedef uint8_t __attribute__((vector_size(16), __may_alias__)) mem_vector;
+typedef uint8_t __attribute__((vector_size(16), __may_alias__, __aligned__(1))) mem_vector_u;
+typedef uint64_t __attribute__((vector_size(16))) mem_vector_u64;
+
+//  Index of the first 0xFF byte of a compare result, or MEM_VECTOR_SIZE if there is none
+static size_t mem_vector_first(mem_vector mask) {
+    mem_vector_u64 m = (mem_vector_u64)mask;
+    if (m[0]) return mem_first_byte(m[0]);
+    if (m[1]) return 8 + mem_first_byte(m[1]);
+    return MEM_VECTOR_SIZE;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#if defined(__x86_64__)
+#define MEM_REP_MOVSW "rep movsq"
+#define MEM_REP_STOSW "rep stosq"
+#else
+#define MEM_REP_MOVSW "rep movsl"
+#define MEM_REP_STOSW "rep stosl"
+#endif
+
+//  Enhanced REP MOVSB/STOSB (CPUID.(EAX=7,ECX=0):EBX[9])
+static int mem_has_erms() {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+    if (eax < 7) return 0;
+    __asm__ ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+    return (ebx >> 9) & 1;
+}
+
+static void mem_copy_erms(void* p, const void* q, size_t n) {
+    __asm__ volatile ("rep movsb" : "+D"(p), "+S"(q), "+c"(n) : : "memory");
+}
+
+static void mem_copy_words(void* p, const void* q, size_t n) {
+    size_t words = n / sizeof(uintptr_t);
+    n %= sizeof(uintptr_t);
+    __asm__ volatile (MEM_REP_MOVSW : "+D"(p), "+S"(q), "+c"(words) : : "memory");
+    __asm__ volatile ("rep movsb" : "+D"(p), "+S"(q), "+c"(n) : : "memory");
+}
+
+static void mem_set_erms(void* p, int v, size_t n) {
+    __asm__ volatile ("rep stosb" : "+D"(p), "+c"(n) : "a"(v) : "memory");
+}
+
+static void mem_set_words(void* p, int v, size_t n) {
+    uintptr_t pattern = MEM_ONES * (uint8_t)v;
+    size_t words = n / sizeof(uintptr_t);
+    n %= sizeof(uintptr_t);
+    __asm__ volatile (MEM_REP_STOSW : "+D"(p), "+c"(words) : "a"(pattern) : "memory");
+    __asm__ volatile ("rep stosb" : "+D"(p), "+c"(n) : "a"(pattern) : "memory");
+}
+
+static void mem_copy_select(void* p, const void* q, size_t n);
+static void mem_set_select(void* p, int v, size_t n);
+static void (*mem_copy)(void*, const void*, size_t) = mem_copy_select;
+static void (*mem_set)(void*, int, size_t) = mem_set_select;
+
+//  The first long block, early in efi_main, picks the variants for the rest of the run
+static void mem_select() {
+    if (mem_has_erms()) {
+        mem_copy = mem_copy_erms;
+        mem_set = mem_set_erms;
+    } else {
+        mem_copy = mem_copy_words;
+        mem_set = mem_set_words;
+    }
+}
+
+static void mem_copy_select(void* p, const void* q, size_t n) {
+    mem_select();
+    mem_copy(p, q, n);
+}
+
+static void mem_set_select(void* p, int v, size_t n) {
+    mem_select();
+    mem_set(p, v, n);
+}
+
+#endif
+
+//  The loops stay in memcpy and memset themselves, where the compiler won't turn them back into calls
 void* memcpy(void* p, const void* q, size_t n) {
     uint8_t* _p = (uint8_t*)p;
     const uint8_t* _q = (const uint8_t*)q;
-    // #pragma clang loop vectorize(enable) interleave(enable)
-    for (int i = 0; i < n; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (n >= MEM_REP_MIN) {
+        mem_copy(p, q, n);
+        return p;
+    }
+#elif defined(__aarch64__)
+    for (; n >= 32; n -= 32, _p += 32, _q += 32) {
+        uint8x16_t v0 = vld1q_u8(_q), v1 = vld1q_u8(_q + 16);
+        vst1q_u8(_p, v0);
+        vst1q_u8(_p + 16, v1);
+    }
+#endif
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t), _p += sizeof(uintptr_t), _q += sizeof(uintptr_t)) {
+        *(mem_word*)_p = *(const mem_word*)_q;
+    }
+    for (; n; n--) {
         *_p++ = *_q++;
     }
     return p;
@@ -24,13 +154,120 @@ void* memcpy(void* p, const void* q, size_t n) {
 
 void* memset(void * p, int v, size_t n) {
     uint8_t* _p = (uint8_t*)p;
-    // #pragma clang loop vectorize(enable) interleave(enable)
-    for (int i = 0; i < n; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (n >= MEM_REP_MIN) {
+        mem_set(p, v, n);
+        return p;
+    }
+#elif defined(__aarch64__)
+    uint8x16_t v16 = vdupq_n_u8(v);
+    for (; n >= 32; n -= 32, _p += 32) {
+        vst1q_u8(_p, v16);
+        vst1q_u8(_p + 16, v16);
+    }
+#endif
+    uintptr_t pattern = MEM_ONES * (uint8_t)v;
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t), _p += sizeof(uintptr_t)) {
+        *(mem_word*)_p = pattern;
+    }
+    for (; n; n--) {
         *_p++ = v;
     }
     return p;
 }
 
+//  memcpy runs forward, so it moves blocks that overlap unless p is above q
+void* memmove(void* p, const void* q, size_t n) {
+    uint8_t* _p = (uint8_t*)p;
+    const uint8_t* _q = (const uint8_t*)q;
+    if ((uintptr_t)_p - (uintptr_t)_q >= n) return memcpy(p, q, n);
+
+    //  Backward, each load done before the store that may overlap it
+    _p += n;
+    _q += n;
+#if defined(MEM_VECTOR_SIZE)
+    for (; n >= MEM_VECTOR_SIZE; n -= MEM_VECTOR_SIZE) {
+        _p -= MEM_VECTOR_SIZE;
+        _q -= MEM_VECTOR_SIZE;
+        *(mem_vector_u*)_p = *(const mem_vector_u*)_q;
+    }
+#endif
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t)) {
+        _p -= sizeof(uintptr_t);
+        _q -= sizeof(uintptr_t);
+        *(mem_word*)_p = *(const mem_word*)_q;
+    }
+    for (; n; n--) {
+        *--_p = *--_q;
+    }
+    return p;
+}
+
+int memcmp(const void* p, const void* q, size_t n) {
+    const uint8_t* _p = (const uint8_t*)p;
+    const uint8_t* _q = (const uint8_t*)q;
+#if defined(MEM_VECTOR_SIZE)
+    for (; n >= MEM_VECTOR_SIZE; n -= MEM_VECTOR_SIZE, _p += MEM_VECTOR_SIZE, _q += MEM_VECTOR_SIZE) {
+        size_t i = mem_vector_first((mem_vector)(*(const mem_vector_u*)_p != *(const mem_vector_u*)_q));
+        if (i < MEM_VECTOR_SIZE) return _p[i] - _q[i];
+    }
+#endif
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t), _p += sizeof(uintptr_t), _q += sizeof(uintptr_t)) {
+        uintptr_t diff = *(const mem_word*)_p ^ *(const mem_word*)_q;
+        if (diff) {
+            size_t i = mem_first_byte(diff);
+            return _p[i] - _q[i];
+        }
+    }
+    for (; n; n--, _p++, _q++) {
+        if (*_p != *_q) return *_p - *_q;
+    }
+    return 0;
+}
+
+void* memchr(const void* p, int c, size_t n) {
+    const uint8_t* _p = (const uint8_t*)p;
+    uint8_t uc = c;
+#if defined(MEM_VECTOR_SIZE)
+    mem_vector v = (mem_vector){ 0 } + uc;
+    for (; n >= MEM_VECTOR_SIZE; n -= MEM_VECTOR_SIZE, _p += MEM_VECTOR_SIZE) {
+        size_t i = mem_vector_first((mem_vector)(*(const mem_vector_u*)_p == v));
+        if (i < MEM_VECTOR_SIZE) return (void*)(_p + i);
+    }
+#endif
+    uintptr_t pattern = MEM_ONES * uc;
+    for (; n >= sizeof(uintptr_t); n -= sizeof(uintptr_t), _p += sizeof(uintptr_t)) {
+        uintptr_t found = mem_zero_bytes(*(const mem_word*)_p ^ pattern);
+        if (found) return (void*)(_p + mem_first_byte(found));
+    }
+    for (; n; n--, _p++) {
+        if (*_p == uc) return (void*)_p;
+    }
+    return NULL;
+}
+
+//  Past the first bytes, the loads are aligned and never cross into a page after the end
+size_t strlen(const char* s) {
+    const char* p = s;
+#if defined(MEM_VECTOR_SIZE)
+    for (; (uintptr_t)p & (MEM_VECTOR_SIZE - 1); p++) {
+        if (!*p) return p - s;
+    }
+    for (;; p += MEM_VECTOR_SIZE) {
+        size_t i = mem_vector_first((mem_vector)(*(const mem_vector*)p == (mem_vector){ 0 }));
+        if (i < MEM_VECTOR_SIZE) return p - s + i;
+    }
+#else
+    for (; (uintptr_t)p & (sizeof(uintptr_t) - 1); p++) {
+        if (!*p) return p - s;
+    }
+    for (;; p += sizeof(uintptr_t)) {
+        uintptr_t found = mem_zero_bytes(*(const mem_aligned_word*)p);
+        if (found) return p - s + mem_first_byte(found);
+    }
+#endif
+}
+
 char *strchr(const char *s, int c) {
     uint8_t uc = c & 0xFF;
     for (;;) {
@@ -45,58 +282,148 @@ char *strchr(const char *s, int c) {
 /*********************************************************************/
 
 
-static int sprintf_num(char** _buffer, uintptr_t val, unsigned base, size_t width, char padding, size_t* _count, size_t _limit, int sign, int _signed) {
-    char* buffer = *_buffer;
-    size_t count = *_count;
+//  "00" to "99", so decimal numbers come out two digits at a time
+static const char sprintf_digits2[] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" "40414243444546474849"
+    "50515253545556575859" "60616263646566676869" "70717273747576777879" "80818283848586878889" "90919293949596979899";
+
+//  Digits of UINT64_MAX, in either base
+#define SPRINTF_MAX_DIGITS 20
+
+//  Divide val by 10000 and return the remainder. A 64-bit division would be a library call on ia32,
+//  so there it goes 16 bits at a time, where each step fits in 32 bits.
+static uint32_t sprintf_div10000(uint64_t* val) {
+#if UINTPTR_MAX > UINT32_MAX
+    uint32_t rem = *val % 10000;
+    *val /= 10000;
+    return rem;
+#else
+    uint32_t hi = *val >> 32, lo = (uint32_t)*val;
+    uint32_t q_hi = hi / 10000, rem = hi % 10000;
+    uint32_t t = (rem << 16) | (lo >> 16);
+    uint32_t q_mid = t / 10000;
+    t = ((t % 10000) << 16) | (lo & 0xFFFF);
+    uint32_t q_lo = t / 10000;
+    *val = ((uint64_t)q_hi << 32) | (q_mid << 16) | q_lo;
+    return t % 10000;
+#endif
+}
 
-    if (_signed) {
-        intptr_t ival = (intptr_t)val;
-        if (ival < 0) {
-            sign = -1;
-            val = 0 - ival;
-        }
+static char* sprintf_put2(char* p, uint32_t n) {
+    p -= 2;
+    p[0] = sprintf_digits2[n * 2];
+    p[1] = sprintf_digits2[n * 2 + 1];
+    return p;
+}
+
+//  Digits of val (base 10 or 16) backward from end, returns the first one
+static char* sprintf_digits(char* end, uint64_t val, unsigned base) {
+    char* p = end;
+    if (base == 16) {
+        do {
+            *--p = "0123456789abcdef"[val & 15];
+            val >>= 4;
+        } while (val);
+        return p;
     }
 
-    if (sign > 0) {
-        *buffer++ = '+';
-        count++;
-    } else if (sign < 0) {
-        *buffer++ = '-';
-        count++;
+    while (val > UINT32_MAX) {
+        uint32_t rem = sprintf_div10000(&val);
+        p = sprintf_put2(p, rem % 100);
+        p = sprintf_put2(p, rem / 100);
+    }
+    uint32_t v = (uint32_t)val;
+    while (v >= 100) {
+        p = sprintf_put2(p, v % 100);
+        v /= 100;
     }
+    if (v >= 10) {
+        p = sprintf_put2(p, v);
+    } else {
+        *--p = '0' + v;
+    }
+    return p;
+}
 
-    uintptr_t work = val;
-    size_t content_size = 0;
-    unsigned mod;
-    do {
-        work /= base;
-        content_size++;
-    } while (work);
+//  Receives the output of vformat a chunk at a time, returns nonzero to stop it
+typedef int (*format_sink)(void* context, const char* s, size_t n);
+
+//  Chunks for a sink are staged on the stack, vsnprintf formats right into its buffer
+#define FORMAT_CHUNK_SIZE 0x200
+
+typedef struct {
+    format_sink sink;
+    void* context;
+    char* buffer;
+    size_t size, used;
+    size_t count;
+    int stopped;
+} format_state;
+
+static void format_flush(format_state* f) {
+    if (f->used && !f->stopped) {
+        if (f->sink(f->context, f->buffer, f->used)) {
+            f->stopped = 1;
+        } else {
+            f->count += f->used;
+        }
+    }
+    f->used = 0;
+}
 
-    if (width > content_size) {
-        content_size = width;
+static void format_put(format_state* f, const char* s, size_t n) {
+    if (f->stopped) return;
+    size_t room = f->size - f->used;
+    if (n > room) {
+        if (!f->sink) {
+            memcpy(f->buffer + f->used, s, room);
+            f->used += room;
+            f->stopped = 1;
+            return;
+        }
+        format_flush(f);
+        if (f->stopped) return;
+        if (n >= f->size) {
+            //  Long strings go to the sink as they are
+            if (f->sink(f->context, s, n)) {
+                f->stopped = 1;
+            } else {
+                f->count += n;
+            }
+            return;
+        }
     }
+    memcpy(f->buffer + f->used, s, n);
+    f->used += n;
+}
 
-    size_t limit = _limit - count;
-    if (limit < content_size) {
-        content_size = limit;
+static void format_putc(format_state* f, char c) {
+    if (f->used < f->size && !f->stopped) {
+        f->buffer[f->used++] = c;
+    } else {
+        format_put(f, &c, 1);
     }
-    if (width) {
-        for (int i = 0; i < width; i++) {
-            buffer[i] = padding;
-        }
+}
+
+static void format_num(format_state* f, uint64_t val, unsigned base, size_t width, char padding, int sign, int _signed) {
+    if (_signed && (int64_t)val < 0) {
+        sign = -1;
+        val = 0 - val;
     }
 
-    for (int i = content_size - 1; i >= 0; i--) {
-        mod = val % base;
-        val /= base;
-        buffer[i] = (mod<10) ? ('0'+mod) : ('a'-10+mod);
-        if (!val) break;
+    if (sign > 0) {
+        format_putc(f, '+');
+    } else if (sign < 0) {
+        format_putc(f, '-');
     }
 
-    *_buffer = buffer + content_size;
-    *_count = count + content_size;
-    return content_size;
+    char digits[SPRINTF_MAX_DIGITS];
+    char* end = digits + SPRINTF_MAX_DIGITS;
+    const char* p = sprintf_digits(end, val, base);
+    for (size_t n = end - p; n < width; n++) {
+        format_putc(f, padding);
+    }
+    format_put(f, p, end - p);
 }
 
 char *strncpy(char *s1, const char *s2, size_t n) {
@@ -112,144 +439,152 @@ int strncmp(const char *s1, const char *s2, size_t n) {
     return (int)*s1 - (int)*s2;
 }
 
-int vsnprintf(char* buffer, size_t limit, const char* format, va_list args) {
-    size_t count = 0;
+static void format_run(format_state* f, const char* format, va_list args) {
     const char* p = format;
-    char* q = buffer;
-    for(;*p && count<limit;) {
+    while (*p && !f->stopped) {
+        if (*p != '%') {
+            const char* run = p;
+            while (*p && *p != '%') p++;
+            format_put(f, run, p - run);
+            continue;
+        }
+        p++;
+
+        size_t width = 0, dot_width = SIZE_MAX;
+        int z_flag = 0;
+        int l_flag = 0;
+        int sign = 0;
+        char padding = ' ';
         char c = *p++;
-        if (c == '%') {
-            size_t width = 0, dot_width = 0;
-            int z_flag = 0;
-            int l_flag = 0;
-            int sign = 0;
-            int dot_width_enable = 0;
-            char padding = ' ';
-            c = *p++;
 
-            if (c == '+') {
-                sign = 1;
-                c = *p++;
-            }
-            if (c == '0') {
-                padding = '0';
-                c = *p++;
-            }
-            while (c >= '0' && c <= '9') {
-                width = width*10 + (c-'0');
-                c = *p++;
-            }
-            if (c == '.') {
-                dot_width_enable = 1;
+        if (c == '+') {
+            sign = 1;
+            c = *p++;
+        }
+        if (c == '0') {
+            padding = '0';
+            c = *p++;
+        }
+        while (c >= '0' && c <= '9') {
+            width = width*10 + (c-'0');
+            c = *p++;
+        }
+        if (c == '.') {
+            c = *p++;
+            if (c == '*') {
+                int n = va_arg(args, int);
+                if (n >= 0) dot_width = n;
                 c = *p++;
+            } else {
+                dot_width = 0;
                 while (c >= '0' && c <= '9') {
                     dot_width = dot_width*10 + (c-'0');
                     c = *p++;
                 }
             }
+        }
 
-            size_t slimit = limit;
-            if (dot_width_enable && limit - count > dot_width) {
-                slimit = count + dot_width;
-            }
+        for(;c == 'z';c=*p++) { z_flag=1; }
+        for(;c == 'l';c=*p++) { l_flag=1; }
+
+        switch(c) {
+            case '\0':
+                return;
+
+            default:
+                format_putc(f, c);
+                break;
+
+            case 'c':
+                format_putc(f, va_arg(args, int));
+                break;
 
-            for(;c == 'z';c=*p++) { z_flag=1; }
-            for(;c == 'l';c=*p++) { l_flag=1; }
-
-            switch(c) {
-                default:
-                    *q++ = c;
-                    count++;
-                    break;
-
-                case 'c':
-                    *q++ = va_arg(args, int);
-                    count++;
-                    break;
-
-                case 's':
-                    {
-                        const char* r = va_arg(args, char*);
-                        if (!r) r = "(null)";
-                        for (; *r && count < slimit; count++) {
-                            *q++ = *r++;
+            case 's':
+                {
+                    const char* r = va_arg(args, char*);
+                    if (!r) r = "(null)";
+                    const char* r_end = (dot_width == SIZE_MAX) ? r + strlen(r) : memchr(r, 0, dot_width);
+                    format_put(f, r, r_end ? (size_t)(r_end - r) : dot_width);
+                }
+                break;
+
+            case 'S':
+                {
+                    const CHAR16* r = va_arg(args, const CHAR16*);
+                    if (!r) r = L"(null)";
+                    //  A character is written whole or not at all, within the precision and the buffer of vsnprintf
+                    for (size_t n = 0; *r; ) {
+                        CHAR16 ch = *r++;
+                        char utf[3];
+                        size_t len;
+                        if (ch < 0x80) {
+                            utf[0] = ch;
+                            len = 1;
+                        } else if (ch < 0x0800) {
+                            utf[0] = 0xC0|(ch>>6);
+                            utf[1] = 0x80|(ch&0x3F);
+                            len = 2;
+                        } else {
+                            utf[0] = 0xE0|(ch>>12);
+                            utf[1] = 0x80|((ch>>6)&0x3F);
+                            utf[2] = 0x80|(ch&0x3F);
+                            len = 3;
                         }
+                        if (dot_width - n < len || (!f->sink && f->size - f->used < len)) break;
+                        format_put(f, utf, len);
+                        n += len;
                     }
-                    break;
-
-                case 'S':
-                    {
-                        const CHAR16* r = va_arg(args, const CHAR16*);
-                        if (!r) r = L"(null)";
-                        for (; *r && count < slimit; count++) {
-                            CHAR16 ch = *r++;
-                            if (ch < 0x80) {
-                                *q++ = ch;
-                            } else if (ch < 0x0800) {
-                                uint8_t utf[] = { 0xC0|(ch>>6), 0x80|(ch&0x3F) };
-                                if (count + 1 < slimit) {
-                                    count++;
-                                    *q++ = utf[0];
-                                    *q++ = utf[1];
-                                } else {
-                                    break;
-                                }
-                            } else {
-                                uint8_t utf[] = { 0xE0|(ch>>12), 0x80|((ch>>6)&0x3F), 0x80|(ch&0x3F) };
-                                if (count + 2 < slimit) {
-                                    count += 2;
-                                    *q++ = utf[0];
-                                    *q++ = utf[1];
-                                    *q++ = utf[2];
-                                } else {
-                                    break;
-                                }
-                            }
+                }
+                break;
+
+            case 'd':
+            case 'u':
+            case 'x':
+                {
+                    uint64_t val;
+                    unsigned base = (c == 'x') ? 16 : 10;
+                    int _signed = (c == 'd');
+                    if(l_flag){
+                        val = va_arg(args, int64_t);
+                    } else if(z_flag) {
+                        if(_signed) {
+                            val = va_arg(args, intptr_t);
+                        } else {
+                            val = va_arg(args, uintptr_t);
                         }
-                    }
-                    break;
-
-                case 'd':
-                case 'u':
-                case 'x':
-                    {
-                        uintptr_t val;
-                        unsigned base = (c == 'x') ? 16 : 10;
-                        int _signed = (c == 'd');
-                        if(l_flag){
-                            val = va_arg(args, int64_t);
-                        } else if(z_flag) {
-                            if(_signed) {
-                                val = va_arg(args, intptr_t);
-                            } else {
-                                val = va_arg(args, uintptr_t);
-                            }
+                    } else {
+                        if (_signed) {
+                            val = va_arg(args, int32_t);
                         } else {
-                            if (_signed) {
-                                val = va_arg(args, int32_t);
-                            } else {
-                                val = va_arg(args, uint32_t);
-                            }
+                            val = va_arg(args, uint32_t);
                         }
-
-                        sprintf_num(&q, val, base, width, padding, &count, limit, sign, _signed);
                     }
-                    break;
 
-                case 'p':
-                    sprintf_num(&q, va_arg(args, uintptr_t), 16, 2*sizeof(void*), '0', &count, limit, 0, 0);
-                    break;
-            }
+                    format_num(f, val, base, width, padding, sign, _signed);
+                }
+                break;
 
-        }else{
-            *q++=c;
-            count++;
+            case 'p':
+                format_num(f, va_arg(args, uintptr_t), 16, 2*sizeof(void*), '0', 0, 0);
+                break;
         }
     }
+}
 
-    if(count<limit) *q++ = '\0';
+//  Format to a sink, returns the number of bytes it took
+int vformat(format_sink sink, void* context, const char* format, va_list args) {
+    char chunk[FORMAT_CHUNK_SIZE];
+    format_state f = { sink, context, chunk, FORMAT_CHUNK_SIZE, 0, 0, 0 };
+    format_run(&f, format, args);
+    format_flush(&f);
+    return f.count;
+}
 
-    return count;
+int vsnprintf(char* buffer, size_t limit, const char* format, va_list args) {
+    format_state f = { NULL, NULL, buffer, limit, 0, 0, 0 };
+    format_run(&f, format, args);
+    if (f.used < limit) buffer[f.used] = '\0';
+    return f.used;
 }
 
 
@@ -261,17 +596,86 @@ int snprintf(char *buffer, size_t n, const char *format, ...) {
     return retval;
 }
 
-#define PRINTF_BUFFER_SIZE 0x1000
-static char printf_buffer[PRINTF_BUFFER_SIZE];
+/*********************************************************************/
 
-int vprintf(const char *format, va_list args) {
-    int count = vsnprintf(printf_buffer, PRINTF_BUFFER_SIZE, format, args);
-    int retval = 0;
-    char *p = printf_buffer;
-    for(int i = 0; i < count; i++) {
-        retval += putchar(*p++);
+
+#define CONSOLE_BUFFER_SIZE 0x200
+static CHAR16 console_buffer[CONSOLE_BUFFER_SIZE];
+static uint32_t utf8_char = 0;
+static int utf8_remain = 0;
+
+static int console_flush(CHAR16* p, int count) {
+    if (p == console_buffer) return count;
+    *p = 0;
+    EFI_STATUS status = cout->OutputString(cout, console_buffer);
+    return EFI_ERROR(status) ? 0 : count;
+}
+
+//  Convert UTF-8 to UTF-16 and pass it to OutputString in one piece (per buffer)
+int console_write(const char* s, size_t n) {
+    CHAR16* p = console_buffer;
+    CHAR16* limit = console_buffer + CONSOLE_BUFFER_SIZE - 3;
+    int count = 0, retval = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        //  Each byte writes up to 3 units ('?', CR and the character), whichever path it takes
+        if (p >= limit) {
+            retval += console_flush(p, count);
+            p = console_buffer;
+            count = 0;
+        }
+
+        uint8_t c = s[i];
+        uint32_t ch;
+        if (c < 0x80) { // ASCII
+            if (utf8_remain) {
+                utf8_remain = 0;
+                *p++ = '?';
+                count++;
+            }
+            ch = c;
+        } else if (c < 0xC0) { // Trail Bytes
+            if (!utf8_remain) {
+                ch = '?';
+            } else {
+                utf8_char = (utf8_char << 6) | (c & 0x3F);
+                if (--utf8_remain) continue;
+                ch = utf8_char;
+            }
+        } else if (c >= 0xC2 && c <= 0xEF) { // Leading Byte
+            if (utf8_remain) {
+                *p++ = '?';
+                count++;
+            }
+            utf8_remain = (c < 0xE0) ? 1 : 2;
+            utf8_char = c & ((c < 0xE0) ? 0x1F : 0x0F);
+            continue;
+        } else { // invalid sequence
+            utf8_remain = 0;
+            ch = '?';
+        }
+
+        if (ch == '\n') {
+            *p++ = '\r';
+        }
+        *p++ = ch;
+        count++;
     }
-    return retval;
+
+    return retval + console_flush(p, count);
+}
+
+int putchar(char c) {
+    return console_write(&c, 1);
+}
+
+static int console_sink(void* context, const char* s, size_t n) {
+    console_write(s, n);
+    return 0;
+}
+
+int vprintf(const char *format, va_list args) {
+    return vformat(console_sink, NULL, format, args);
 }
 
 int printf(const char *format, ...) {
@@ -9,21 +9,118 @@
 #include "megh0816.h"
 #define FONT_PROPERTY(x) MEGH0816_ ## x
 
+#include "cp932tbl.h"
+#include "aafont.h"
+
+#ifndef ATOP_GLYPH_CACHE_SIZE
+#define ATOP_GLYPH_CACHE_SIZE	256
+#endif
+#define ATOP_GLYPH_CACHE_HASH	64
+
+//  Screen rotation in degrees clockwise, or -1 to turn portrait screens by 90 degrees
+#ifndef ATOP_ROTATION
+#define ATOP_ROTATION	-1
+#endif
+
+//  Integer scale of the text, or 0 to scale by the resolution: 1x below 2560x1440, 2x below 3840x2160, 3x above
+#ifndef ATOP_SCALE
+#define ATOP_SCALE	0
+#endif
+//  Largest scale chosen by the resolution. Every pixel of a cell is copied, so a cell at n times
+//  costs about n^2 times one at 1x: 3x is readable on 4K, -DATOP_SCALE_MAX=1 keeps the cost of 1x
+#ifndef ATOP_SCALE_MAX
+#define ATOP_SCALE_MAX	3
+#endif
+#define ATOP_SCALE_WIDTH	1280
+#define ATOP_SCALE_HEIGHT	720
+
+//  Blink period of the cursor in 100ns units
+#define ATOP_CURSOR_BLINK	5000000
+
+//  Lines kept after they scroll off the top of the screen
+#ifndef ATOP_SCROLLBACK_LINES
+#define ATOP_SCROLLBACK_LINES	512
+#endif
+
+//  Displays that show a copy of the screen besides the one ATOP renders for
+#ifndef ATOP_MAX_MIRRORS
+#define ATOP_MAX_MIRRORS	3
+#endif
+
+void *memcpy(void *, const void *, size_t);
 void *memset(void *, int, size_t);
 void *malloc(size_t);
+void free(void *);
 
-void *blt_buffer = NULL;
 
+typedef struct {
+    uint16_t code;
+    uint8_t attr, flags;
+} ATOP_cell;
+
+#define	ATOP_CELL_WIDE	0x01
+#define	ATOP_CELL_TAIL	0x02
+
+typedef struct {
+    int16_t left, right;
+} ATOP_span;
+
+typedef struct {
+    uint32_t code, fgcolor, bgcolor;
+    int hash_next, lru_prev, lru_next;
+} ATOP_glyph_entry;
+
+typedef struct {
+    ATOP_glyph_entry entries[ATOP_GLYPH_CACHE_SIZE];
+    int hash[ATOP_GLYPH_CACHE_HASH];
+    int used, lru_head, lru_tail;
+    uint32_t *pixels;
+    intptr_t entry_size;
+    uint32_t hits, misses;
+} ATOP_glyph_cache;
+
+//  Glyph bitmaps (1bpp) or coverage maps (8bpp) laid out in the scan order of the screen,
+//  at the scale of the screen. w8 and src_w8 are bytes per line
+typedef struct {
+    uint8_t *atlas, *scratch;
+    const uint8_t *glyphs;
+    const uint8_t *(*fetch)(intptr_t index);
+    intptr_t count, w, h, w8, size, src_w8, rotate, scale, bpp;
+} ATOP_font;
+
+//  A display that takes the pixels of the shadow buffer as they are, centered on its own mode
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL* gop;
+    gop_pixel_format pixel;
+    intptr_t offset_x, offset_y, active;
+} ATOP_mirror;
 
 typedef struct {
     SIMPLE_TEXT_OUTPUT_MODE mode;
     EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text;
     EFI_GRAPHICS_OUTPUT_PROTOCOL* gop;
+    gop_pixel_format pixel;
+    uint32_t palette[16];
     uint32_t fgcolor, bgcolor;
-    intptr_t cols, rows, padding_x, padding_y, rotate;
-    intptr_t font_w, font_h, font_w8, line_height, font_offset;
-    const uint8_t *font_data;
+    intptr_t cols, rows, padding_x, padding_y, rotate, scale, smooth, screen_w, screen_h;
+    intptr_t font_w, font_h, line_height, font_offset;
+    ATOP_font font, wide_font;
     uint8_t mode_cols, mode_rows;
+    uint32_t *shadow;
+    intptr_t shadow_w, shadow_h, shadow_size;
+    intptr_t dirty_l, dirty_t, dirty_r, dirty_b;
+    ATOP_glyph_cache glyph_cache;
+    ATOP_cell *cells;
+    ATOP_span *row_dirty;
+    intptr_t cells_size, top_row, pending_scroll;
+    ATOP_cell *history;
+    intptr_t history_size, history_head, history_count, view_offset;
+    EFI_EVENT cursor_timer;
+    intptr_t cursor_phase, cursor_shown;
+    int cursor_x, cursor_y, cursor_w, cursor_h;
+    ATOP_render_stat stat;
+    ATOP_mirror mirrors[ATOP_MAX_MIRRORS];
+    intptr_t n_mirrors;
 } ATOP_Context;
 
 typedef struct {
@@ -46,30 +143,63 @@ uint32_t palette[] = {
 
 typedef struct {
     uint16_t begin, end;
-    uint32_t off;
+    uint32_t index;
 } fontx2_zn_table;
 
+#define FONTX2_PAGE_GLYPHS	64
+
 typedef struct {
     uint8_t *rawPtr;
+    const uint8_t *glyphs;
     fontx2_zn_table *table;
-    intptr_t font_w, font_h, font_w8, tbl_cnt;
+    intptr_t font_w, font_h, font_w8, tbl_cnt, glyph_cnt, glyph_size;
+    uint8_t lead_map[256];
+    uint16_t *glyph_map;
+    EFI_FILE_HANDLE file;
+    uint8_t **pages;
+    intptr_t page_cnt, pages_loaded, resident;
 } fontx2_zn_font;
 
-static uint16_t *uni2ansi_tbl = NULL;
+//  Unicode to CP932 in pages of 256 code points, empty pages share one page of zeros.
+//  Starts with the table generated at build time
+static const uint16_t* const *uni2ansi_tbl = cp932_builtin_tbl;
+static void *uni2ansi_buffer = NULL;
+static int uni2ansi_page_count = sizeof(cp932_builtin_pages) / sizeof(cp932_builtin_pages[0]) - 1;
 static fontx2_zn_font font_zn;
 
+//  Replace the built-in table with the one in CP932.BIN
 EFI_STATUS cp932_tbl_init(base_and_size table_bin_ptr) {
 
-    const size_t sizeof_unitable = 0x20000;
-    uni2ansi_tbl = malloc(sizeof_unitable);
-    if (!uni2ansi_tbl) return EFI_OUT_OF_RESOURCES;
-    memset(uni2ansi_tbl, 0, sizeof_unitable);
+    uint16_t *bin = table_bin_ptr.base;
+    size_t length = *bin++;
+
+    //  Allocate only the pages that have any code point
+    int8_t used[256];
+    memset(used, 0, sizeof(used));
+    int page_count = 0;
+    for (int i = 0; i < length; i++) {
+        if (!used[bin[i] >> 8]) {
+            used[bin[i] >> 8] = 1;
+            page_count++;
+        }
+    }
+    const uint16_t **tbl = malloc(sizeof(uint16_t *) * 256 + sizeof(uint16_t) * 256 * page_count);
+    if (!tbl) return EFI_OUT_OF_RESOURCES;
+    uint16_t *next_page = (uint16_t *)(tbl + 256);
+    memset(next_page, 0, sizeof(uint16_t) * 256 * page_count);
+    for (int i = 0; i < 256; i++) {
+        if (used[i]) {
+            tbl[i] = next_page;
+            next_page += 256;
+        } else {
+            tbl[i] = cp932_builtin_pages[0];
+        }
+    }
 
     uint16_t cp932_code = 0x8140;
-    uint16_t *p = table_bin_ptr.base;
-    size_t length = *p++;
+    uint16_t *p = bin;
     for (int i = 0; i < length; i++, p++){
-        uni2ansi_tbl[*p] = cp932_code;
+        ((uint16_t *)tbl[*p >> 8])[*p & 0xFF] = cp932_code;
         cp932_code++;
         if ((cp932_code & 0xFF) == 0x7F) {
             cp932_code++;
@@ -81,33 +211,199 @@ EFI_STATUS cp932_tbl_init(base_and_size table_bin_ptr) {
         }
     }
 
+    free(uni2ansi_buffer);
+    uni2ansi_buffer = tbl;
+    uni2ansi_tbl = tbl;
+    uni2ansi_page_count = page_count;
+
     return EFI_SUCCESS;
 }
 
-EFI_STATUS cp932_font_init(base_and_size font_ptr) {
+//  CP932 code of a Unicode code point, or 0
+uint32_t cp932_from_unicode(uint32_t c) {
+    if (c >= 0x10000) return 0;
+    return uni2ansi_tbl[c >> 8][c & 0xFF];
+}
+
+void cp932_get_tbl_stat(cp932_tbl_stat* result) {
+    result->pages = uni2ansi_page_count;
+    result->paged_size = sizeof(uint16_t *) * 256 + sizeof(uint16_t) * 256 * (uni2ansi_page_count + 1);
+    result->flat_size = sizeof(uint16_t) * 0x10000;
+}
+
+//  Free the tables built by fontx2_init_table
+static void fontx2_release_table() {
+    free(font_zn.table);
+    free(font_zn.glyph_map);
+    font_zn.table = NULL;
+    font_zn.glyph_map = NULL;
+    font_zn.glyph_cnt = 0;
+    font_zn.resident = 0;
+}
+
+//  Parse the header and the range table at font_zn.rawPtr
+static EFI_STATUS fontx2_init_table() {
 
-    font_zn.rawPtr	= font_ptr.base;
     font_zn.font_w	= font_zn.rawPtr[0x0E];
     font_zn.font_h	= font_zn.rawPtr[0x0F];
     font_zn.font_w8 = (font_zn.font_w + 7) >> 3;
+    font_zn.glyph_size = font_zn.font_w8 * font_zn.font_h;
     font_zn.tbl_cnt	= font_zn.rawPtr[0x11];
     font_zn.table = malloc(sizeof(fontx2_zn_table) * font_zn.tbl_cnt);
     if(!font_zn.table) return EFI_OUT_OF_RESOURCES;
 
-    int sizeof_font = font_zn.font_w8*font_zn.font_h;
-
-    uint32_t base = 0x12 + font_zn.tbl_cnt * 4;
+    uint32_t index = 0;
     for (int i = 0; i < font_zn.tbl_cnt; i++) {
         int a = i * 4 + 0x12;
         font_zn.table[i].begin	= font_zn.rawPtr[a+1] * 256 + font_zn.rawPtr[a + 0];
         font_zn.table[i].end	= font_zn.rawPtr[a+3] * 256 + font_zn.rawPtr[a + 2];
-        font_zn.table[i].off	= base;
-        base += sizeof_font * (font_zn.table[i].end - font_zn.table[i].begin + 1);
+        font_zn.table[i].index	= index;
+        index += font_zn.table[i].end - font_zn.table[i].begin + 1;
+    }
+    font_zn.glyph_cnt = index;
+
+    //  Two level index: lead byte -> row of 256 trail bytes -> glyph index + 1
+    int rows = 0;
+    memset(font_zn.lead_map, 0, sizeof(font_zn.lead_map));
+    for (int i = 0; i < font_zn.tbl_cnt; i++) {
+        for (int lead = font_zn.table[i].begin >> 8; lead <= font_zn.table[i].end >> 8; lead++) {
+            if (!font_zn.lead_map[lead] && rows < 255) {
+                font_zn.lead_map[lead] = ++rows;
+            }
+        }
+    }
+    font_zn.glyph_map = malloc(sizeof(uint16_t) * 256 * rows);
+    if (!font_zn.glyph_map) return EFI_OUT_OF_RESOURCES;
+    memset(font_zn.glyph_map, 0, sizeof(uint16_t) * 256 * rows);
+    for (int i = 0; i < font_zn.tbl_cnt; i++) {
+        uint32_t glyph = font_zn.table[i].index;
+        for (uint32_t c = font_zn.table[i].begin; c <= font_zn.table[i].end && glyph < 0xFFFF; c++, glyph++) {
+            int row = font_zn.lead_map[c >> 8];
+            if (row && !font_zn.glyph_map[(row - 1) * 256 + (c & 0xFF)]) {
+                font_zn.glyph_map[(row - 1) * 256 + (c & 0xFF)] = glyph + 1;
+            }
+        }
     }
+    font_zn.resident = sizeof(fontx2_zn_table) * font_zn.tbl_cnt + sizeof(uint16_t) * 256 * rows;
 
     return EFI_SUCCESS;
 }
 
+EFI_STATUS cp932_font_init(base_and_size font_ptr) {
+    font_zn.rawPtr = font_ptr.base;
+    EFI_STATUS status = fontx2_init_table();
+    if (EFI_ERROR(status)) {
+        fontx2_release_table();
+        font_zn.rawPtr = NULL;
+        return status;
+    }
+    font_zn.glyphs = font_zn.rawPtr + 0x12 + font_zn.tbl_cnt * 4;
+    font_zn.resident += font_ptr.size;
+    return EFI_SUCCESS;
+}
+
+//  Read the header and the range table now, and the glyphs a page at a time on first use.
+//  The font keeps the file open
+EFI_STATUS cp932_font_open(EFI_FILE_HANDLE file) {
+    uint8_t header[0x12];
+    UINTN size = sizeof(header);
+    EFI_STATUS status = file->SetPosition(file, 0);
+    if (!EFI_ERROR(status)) status = file->Read(file, &size, header);
+    if (EFI_ERROR(status)) return status;
+    if (size < sizeof(header)) return EFI_LOAD_ERROR;
+    for (int i = 0; i < 6; i++) {
+        if (header[i] != "FONTX2"[i]) return EFI_LOAD_ERROR;
+    }
+
+    intptr_t header_size = sizeof(header) + header[0x11] * 4;
+    uint8_t *raw = malloc(header_size);
+    if (!raw) return EFI_OUT_OF_RESOURCES;
+    memcpy(raw, header, sizeof(header));
+    size = header_size - sizeof(header);
+    status = file->Read(file, &size, raw + sizeof(header));
+    if (!EFI_ERROR(status) && size < header_size - sizeof(header)) status = EFI_LOAD_ERROR;
+    if (EFI_ERROR(status)) {
+        free(raw);
+        return status;
+    }
+
+    font_zn.rawPtr = raw;
+    status = fontx2_init_table();
+    if (!EFI_ERROR(status)) {
+        font_zn.page_cnt = (font_zn.glyph_cnt + FONTX2_PAGE_GLYPHS - 1) / FONTX2_PAGE_GLYPHS;
+        font_zn.pages = malloc(sizeof(uint8_t *) * font_zn.page_cnt);
+        if (!font_zn.pages) status = EFI_OUT_OF_RESOURCES;
+    }
+    if (EFI_ERROR(status)) {
+        //  Leave nothing behind for the caller's fallback to the eager read
+        fontx2_release_table();
+        free(raw);
+        font_zn.rawPtr = NULL;
+        return status;
+    }
+    memset(font_zn.pages, 0, sizeof(uint8_t *) * font_zn.page_cnt);
+    font_zn.pages_loaded = 0;
+    font_zn.resident += header_size + sizeof(uint8_t *) * font_zn.page_cnt;
+    font_zn.glyphs = NULL;
+    font_zn.file = file;
+
+    return EFI_SUCCESS;
+}
+
+//  Bitmap of a glyph, reading its page from the file on first use
+const uint8_t *cp932_font_glyph(intptr_t index) {
+    if (index < 0 || index >= font_zn.glyph_cnt) return NULL;
+    if (font_zn.glyphs) return font_zn.glyphs + index * font_zn.glyph_size;
+    if (!font_zn.pages) return NULL;
+
+    intptr_t page = index / FONTX2_PAGE_GLYPHS, first = page * FONTX2_PAGE_GLYPHS;
+    if (!font_zn.pages[page]) {
+        intptr_t count = font_zn.glyph_cnt - first;
+        if (count > FONTX2_PAGE_GLYPHS) count = FONTX2_PAGE_GLYPHS;
+        UINTN size = count * font_zn.glyph_size;
+        uint8_t *buffer = malloc(size);
+        if (!buffer) return NULL;
+
+        EFI_FILE_HANDLE file = font_zn.file;
+        EFI_STATUS status = file->SetPosition(file, 0x12 + font_zn.tbl_cnt * 4 + first * font_zn.glyph_size);
+        if (!EFI_ERROR(status)) status = file->Read(file, &size, buffer);
+        if (EFI_ERROR(status)) {
+            free(buffer);
+            return NULL;
+        }
+        if (size < count * font_zn.glyph_size) {
+            memset(buffer + size, 0, count * font_zn.glyph_size - size);
+        }
+
+        font_zn.pages[page] = buffer;
+        font_zn.pages_loaded++;
+        font_zn.resident += count * font_zn.glyph_size;
+    }
+    return font_zn.pages[page] + (index - first) * font_zn.glyph_size;
+}
+
+//  Drop the font and its pages, closing the file of a paged font.
+//  The contents given to cp932_font_init stay with the caller
+void cp932_font_close() {
+    fontx2_release_table();
+    if (font_zn.file) {
+        for (intptr_t i = 0; i < font_zn.page_cnt; i++) {
+            free(font_zn.pages[i]);
+        }
+        free(font_zn.pages);
+        free(font_zn.rawPtr);
+        font_zn.file->Close(font_zn.file);
+    }
+    memset(&font_zn, 0, sizeof(font_zn));
+}
+
+void cp932_get_font_stat(cp932_font_stat* result) {
+    result->glyphs = font_zn.glyph_cnt;
+    result->pages = font_zn.page_cnt;
+    result->pages_loaded = font_zn.pages_loaded;
+    result->resident = font_zn.resident;
+}
+
 
 static int ATOP_col_to_x(ATOP_Context *self, int x) {
     return self->padding_x + self->font_w * x;
@@ -117,24 +413,105 @@ static int ATOP_row_to_y(ATOP_Context *self, int y) {
     return self->padding_y + self->line_height * y;
 }
 
+//  Screen size as seen by the text, after rotation
+static void ATOP_get_screen_size(ATOP_Context *self, int *w, int *h) {
+    if (self->rotate & 1) {
+        *w = self->gop->Mode->Info->VerticalResolution;
+        *h = self->gop->Mode->Info->HorizontalResolution;
+    } else {
+        *w = self->gop->Mode->Info->HorizontalResolution;
+        *h = self->gop->Mode->Info->VerticalResolution;
+    }
+}
+
 static ATOP_Context* ATOP_unboxing(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text) {
     return (ATOP_Context *)(text->Mode);
 }
 
 
-static void ATOP_fill_rect(ATOP_Context *self, int x, int y, int w, int h, uint32_t color) {
-    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = self->gop;
+static void ATOP_mark_dirty(ATOP_Context *self, int x, int y, int w, int h) {
+    if (self->dirty_r <= self->dirty_l) {
+        self->dirty_l = x;
+        self->dirty_t = y;
+        self->dirty_r = x + w;
+        self->dirty_b = y + h;
+    } else {
+        if (self->dirty_l > x) self->dirty_l = x;
+        if (self->dirty_t > y) self->dirty_t = y;
+        if (self->dirty_r < x + w) self->dirty_r = x + w;
+        if (self->dirty_b < y + h) self->dirty_b = y + h;
+    }
+}
+
+//  Write a rectangle of the shadow buffer to every display
+static void ATOP_write_screens(ATOP_Context *self, int x, int y, int w, int h) {
+    const uint32_t *src = self->shadow + y * self->shadow_w + x;
+    gop_write_pixels(&self->pixel, src, self->shadow_w, x, y, w, h);
+    for (int i = 0; i < self->n_mirrors; i++) {
+        ATOP_mirror *mirror = self->mirrors + i;
+        if (!mirror->active) continue;
+        gop_write_pixels(&mirror->pixel, src, self->shadow_w, x + mirror->offset_x, y + mirror->offset_y, w, h);
+    }
+}
+
+static void ATOP_fill_screens(ATOP_Context *self, uint32_t color, int x, int y, int w, int h) {
+    gop_fill_pixels(&self->pixel, color, x, y, w, h);
+    for (int i = 0; i < self->n_mirrors; i++) {
+        ATOP_mirror *mirror = self->mirrors + i;
+        if (!mirror->active) continue;
+        gop_fill_pixels(&mirror->pixel, color, x + mirror->offset_x, y + mirror->offset_y, w, h);
+    }
+}
+
+//  Push the dirty region of the shadow buffer to the video memory
+static void ATOP_flush(ATOP_Context *self) {
+    if (self->dirty_r <= self->dirty_l || self->dirty_b <= self->dirty_t) return;
+    int x = self->dirty_l, y = self->dirty_t, w = self->dirty_r - x, h = self->dirty_b - y;
+    ATOP_write_screens(self, x, y, w, h);
+    self->dirty_l = self->dirty_t = self->dirty_r = self->dirty_b = 0;
+}
+
+//  Follow the mode of the shadow buffer: the mirror takes its pixels through Blt
+//  if its own layout differs, and is left dark if it can't take them at all
+static void ATOP_mirror_reset(ATOP_Context *self, ATOP_mirror *mirror) {
+    gop_pixel_format_init(&mirror->pixel, mirror->gop);
+    mirror->offset_x = (mirror->pixel.width - self->shadow_w) / 2;
+    mirror->offset_y = (mirror->pixel.height - self->shadow_h) / 2;
+    gop_fill_pixels(&mirror->pixel, 0, 0, 0, mirror->pixel.width, mirror->pixel.height);
+    mirror->active = gop_pixel_format_mirror(&mirror->pixel, &self->pixel);
+}
 
-    if(self->rotate) {
-        int z = x;
-        x = gop->Mode->Info->HorizontalResolution - y - h;
-        y = z;
-        z = w;
-        w = h;
-        h = z;
+//  Map a logical rectangle in a container of cw x ch onto the rotated physical one
+static void ATOP_rotate_rect(int rotate, int cw, int ch, int *x, int *y, int *w, int *h) {
+    int z;
+    switch (rotate) {
+    case 1:
+        z = *x;
+        *x = ch - *y - *h;
+        *y = z;
+        break;
+    case 2:
+        *x = cw - *x - *w;
+        *y = ch - *y - *h;
+        return;
+    case 3:
+        z = *y;
+        *y = cw - *x - *w;
+        *x = z;
+        break;
+    default:
+        return;
     }
+    z = *w;
+    *w = *h;
+    *h = z;
+}
 
-    int r = x + w, b = y + h, sw = self->gop->Mode->Info->HorizontalResolution, sh = self->gop->Mode->Info->VerticalResolution;
+static void ATOP_fill_rect(ATOP_Context *self, int x, int y, int w, int h, uint32_t color) {
+
+    ATOP_rotate_rect(self->rotate, self->screen_w, self->screen_h, &x, &y, &w, &h);
+
+    int r = x + w, b = y + h, sw = self->shadow_w, sh = self->shadow_h;
     if (x < 0) x = 0;
     if (y < 0) y = 0;
     if (r > sw) r = sw;
@@ -143,58 +520,146 @@ static void ATOP_fill_rect(ATOP_Context *self, int x, int y, int w, int h, uint3
     h = b - y;
     if (x > sw || y > sh || w <= 0 || h <= 0) return;
 
-    gop->Blt(gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)&color, EfiBltVideoFill, 0, 0, x, y, w, h, 0);
-}
-
-//	TODO: more better code
-static void ATOP_draw_pattern(ATOP_Context *self, int x, int y, int w, int h, const uint8_t *pattern, uint32_t color) {
-    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = self->gop;
-    int sw = self->gop->Mode->Info->HorizontalResolution;
-    int ppl = gop->Mode->Info->PixelsPerScanLine;
-    int w8 = (w + 7) / 8;
-
-    if (x < 0 || y < 0) return;
-
-    if (self->rotate) {
-        y = sw - y - h;
-        int wl = ppl - h;
-        uint32_t *p = (uint32_t *)gop->Mode->FrameBufferBase + x * ppl + y;
-
-        int l = w;
-        for (int k = 0; k < w8; k++, l -= 8) {
-            int m = (l > 8) ? 8 : l;
-            for (int i = 0; i < m; i++) {
-                uint32_t mask = 0x80 >> i;
-                for (int j = h - 1; j >= 0; j--,p++) {
-                    if (pattern[j * w8 + k] & mask) {
-                        *p = color;
-                    }
-                }
-                p += wl;
-            }
+    uint32_t *p = self->shadow + y * sw + x;
+    for (int i = 0; i < h; i++, p += sw) {
+        for (int j = 0; j < w; j++) {
+            p[j] = color;
         }
+    }
+    ATOP_mark_dirty(self, x, y, w, h);
+}
 
-    } else {
-        int wl = ppl - w;
-        uint32_t *p = (uint32_t *)gop->Mode->FrameBufferBase + y * ppl + x;
-
-        for (int i = 0; i < h; i++) {
-            int l = w;
-            for (int k = 0; k < w8; k++, l -= 8) {
-                int m = (l > 8) ? 8 : l;
-                uint8_t font_pattern = *pattern++;
-                for (int j = 0; j < m; j++, p++) {
-                    if (font_pattern & (0x80 >> j)) {
-                        *p = color;
-                    }
-                }
+//  Copy a pixel block to the shadow buffer
+static void ATOP_put_block(ATOP_Context *self, int x, int y, int w, int h, const uint32_t *block) {
+
+    ATOP_rotate_rect(self->rotate, self->screen_w, self->screen_h, &x, &y, &w, &h);
+
+    int delta = w, r = x + w, b = y + h, sw = self->shadow_w, sh = self->shadow_h;
+    if (x < 0) {
+        block -= x;
+        x = 0;
+    }
+    if (y < 0) {
+        block -= y * delta;
+        y = 0;
+    }
+    if (r > sw) r = sw;
+    if (b > sh) b = sh;
+    w = r - x;
+    h = b - y;
+    if (x > sw || y > sh || w <= 0 || h <= 0) return;
+
+    //  Whole rows through memcpy, which moves long ones by rep movs or NEON
+    uint32_t *p = self->shadow + y * sw + x;
+    for (int i = 0; i < h; i++, p += sw, block += delta) {
+        memcpy(p, block, sizeof(uint32_t) * w);
+    }
+    ATOP_mark_dirty(self, x, y, w, h);
+}
+
+//  Expand a 1bpp pattern of w x h into a pixel block whose scan lines are pitch pixels apart
+static void ATOP_draw_pattern(uint32_t *block, int pitch, const uint8_t *pattern, int w8, int w, int h, uint32_t fgcolor, uint32_t bgcolor) {
+    for (int i = 0; i < h; i++) {
+        glyph_expand(block + i * pitch, pattern + i * w8, w, fgcolor, bgcolor);
+    }
+}
+
+//  Blend an 8bpp coverage map of w x h into a pixel block whose scan lines are pitch pixels apart
+static void ATOP_draw_coverage(uint32_t *block, int pitch, const uint8_t *coverage, int w8, int w, int h, uint32_t fgcolor, uint32_t bgcolor) {
+    for (int i = 0; i < h; i++) {
+        glyph_blend(block + i * pitch, coverage + i * w8, w, fgcolor, bgcolor);
+    }
+}
+
+//  Scale one glyph and turn it into the scan order of the screen
+static void ATOP_rotate_glyph(const ATOP_font *font, uint8_t *dst, const uint8_t *src) {
+    int w = font->w, h = font->h, scale = font->scale;
+    memset(dst, 0, font->size);
+    for (int j = 0; j < h; j++) {
+        const uint8_t *line = src + (j / scale) * font->src_w8;
+        for (int i = 0; i < w; i++) {
+            int si = i / scale;
+            uint8_t value = (font->bpp == 8) ? line[si] : (line[si >> 3] & (0x80 >> (si & 7))) ? 0xFF : 0;
+            if (!value) continue;
+            int px, py;
+            switch (font->rotate) {
+            case 0:
+                px = i;
+                py = j;
+                break;
+            case 1:
+                px = h - 1 - j;
+                py = i;
+                break;
+            case 2:
+                px = w - 1 - i;
+                py = h - 1 - j;
+                break;
+            default:
+                px = j;
+                py = w - 1 - i;
+                break;
+            }
+            if (font->bpp == 8) {
+                dst[py * font->w8 + px] = value;
+            } else {
+                dst[py * font->w8 + (px >> 3)] |= 0x80 >> (px & 7);
             }
-            p += wl;
         }
     }
+}
+
+//  Prepare glyphs of src_w x src_h magnified by scale and clipped to w x h. Glyphs in memory
+//  are scaled and rotated into an atlas at once, glyphs read by fetch one by one when drawn
+static EFI_STATUS ATOP_font_init(ATOP_font *font, int rotate, int scale, int bpp, const uint8_t *data, const uint8_t *(*fetch)(intptr_t), intptr_t count, intptr_t src_w, intptr_t src_h, intptr_t w, intptr_t h) {
+    intptr_t src_w8 = (bpp == 8) ? src_w : (src_w + 7) / 8, src_size = src_w8 * src_h;
+
+    free(font->atlas);
+    free(font->scratch);
+    font->atlas = font->scratch = NULL;
+    font->glyphs = data;
+    font->fetch = fetch;
+    font->count = (data || fetch) ? count : 0;
+    font->rotate = rotate;
+    font->scale = scale;
+    font->bpp = bpp;
+    font->w = (w < src_w * scale) ? w : src_w * scale;
+    font->h = (h < src_h * scale) ? h : src_h * scale;
+    font->src_w8 = font->w8 = src_w8;
+    font->size = src_size;
+    if ((!rotate && scale == 1) || !font->count) return EFI_SUCCESS;
+
+    font->w8 = (rotate & 1) ? font->h : font->w;
+    if (bpp != 8) font->w8 = (font->w8 + 7) / 8;
+    font->size = font->w8 * ((rotate & 1) ? font->w : font->h);
+    if (!data) {
+        font->scratch = malloc(font->size);
+        if (!font->scratch) font->count = 0;
+        return font->scratch ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+    }
 
+    uint8_t *atlas = malloc(font->size * count);
+    if (!atlas) {
+        font->glyphs = NULL;
+        font->count = 0;
+        return EFI_OUT_OF_RESOURCES;
+    }
+    for (intptr_t k = 0; k < count; k++) {
+        ATOP_rotate_glyph(font, atlas + k * font->size, data + k * src_size);
+    }
+    font->atlas = atlas;
+    font->glyphs = atlas;
+    return EFI_SUCCESS;
 }
 
+static const uint8_t *ATOP_font_glyph(const ATOP_font *font, intptr_t index) {
+    if (index < 0 || index >= font->count) return NULL;
+    if (font->glyphs) return font->glyphs + index * font->size;
+    const uint8_t *src = font->fetch(index);
+    if (!src || (!font->rotate && font->scale == 1)) return src;
+    ATOP_rotate_glyph(font, font->scratch, src);
+    return font->scratch;
+}
 
 static void ATOP_fill_block(ATOP_Context *self, int x, int y, int w, int h, uint32_t color) {
     ATOP_fill_rect(self, ATOP_col_to_x(self, x), ATOP_row_to_y(self, y), self->font_w * w, self->line_height * h, color);
@@ -213,57 +678,305 @@ static uint32_t ATOP_conv_glyph(uint32_t c) {
         }
     } else if (c < 0x80) {
         return c;
-    } else if (c < 0x10000) {
-        if (uni2ansi_tbl){
-            uint32_t converted = uni2ansi_tbl[c];
-            return converted ? converted : INVALID_UNICHAR;
+    } else {
+        uint32_t converted = cp932_from_unicode(c);
+        return converted ? converted : INVALID_UNICHAR;
+    }
+}
+
+//  Glyph index of a CP932 code in the loaded font, or -1
+intptr_t cp932_font_find(uint32_t c) {
+    if (c > 0xFFFF || !font_zn.glyph_map) return -1;
+    int row = font_zn.lead_map[c >> 8];
+    if (!row) return -1;
+    return (intptr_t)font_zn.glyph_map[(row - 1) * 256 + (c & 0xFF)] - 1;
+}
+
+
+static int ATOP_glyph_hash(uint32_t code, uint32_t fgcolor, uint32_t bgcolor) {
+    uint32_t hash = (code * 0x9E3779B1) ^ fgcolor ^ (bgcolor << 1);
+    return (hash ^ (hash >> 16)) & (ATOP_GLYPH_CACHE_HASH - 1);
+}
+
+static void ATOP_glyph_cache_unlink(ATOP_glyph_cache *cache, int index) {
+    ATOP_glyph_entry *entry = &cache->entries[index];
+    if (entry->lru_prev >= 0) {
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next >= 0) {
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void ATOP_glyph_cache_push(ATOP_glyph_cache *cache, int index) {
+    ATOP_glyph_entry *entry = &cache->entries[index];
+    entry->lru_prev = -1;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head >= 0) {
+        cache->entries[cache->lru_head].lru_prev = index;
+    } else {
+        cache->lru_tail = index;
+    }
+    cache->lru_head = index;
+}
+
+static void ATOP_glyph_cache_reset(ATOP_Context *self) {
+    ATOP_glyph_cache *cache = &self->glyph_cache;
+    cache->used = 0;
+    cache->lru_head = cache->lru_tail = -1;
+    for (int i = 0; i < ATOP_GLYPH_CACHE_HASH; i++) {
+        cache->hash[i] = -1;
+    }
+
+    intptr_t entry_size = 2 * self->font_w * self->line_height;
+    if (cache->entry_size < entry_size) {
+        free(cache->pixels);
+        cache->pixels = malloc(sizeof(uint32_t) * entry_size * ATOP_GLYPH_CACHE_SIZE);
+        cache->entry_size = cache->pixels ? entry_size : 0;
+    }
+}
+
+//  Returns the pixel block of a cell, expanding the glyph on a cache miss
+static const uint32_t *ATOP_get_glyph(ATOP_Context *self, uint32_t code, int width, const ATOP_font *font, intptr_t glyph, uint32_t fgcolor, uint32_t bgcolor) {
+    ATOP_glyph_cache *cache = &self->glyph_cache;
+    if (!cache->entry_size) return NULL;
+
+    int hash = ATOP_glyph_hash(code, fgcolor, bgcolor);
+    for (int i = cache->hash[hash]; i >= 0; i = cache->entries[i].hash_next) {
+        ATOP_glyph_entry *entry = &cache->entries[i];
+        if (entry->code == code && entry->fgcolor == fgcolor && entry->bgcolor == bgcolor) {
+            cache->hits++;
+            if (cache->lru_head != i) {
+                ATOP_glyph_cache_unlink(cache, i);
+                ATOP_glyph_cache_push(cache, i);
+            }
+            return cache->pixels + i * cache->entry_size;
+        }
+    }
+    cache->misses++;
+
+    //  A glyph the font has but could not read is not cached, so the next lookup retries it
+    const uint8_t *pattern = ATOP_font_glyph(font, glyph);
+    if (!pattern && glyph >= 0 && glyph < font->count) return NULL;
+
+    int index;
+    if (cache->used < ATOP_GLYPH_CACHE_SIZE) {
+        index = cache->used++;
+    } else {
+        //  Evict the least recently used entry
+        index = cache->lru_tail;
+        ATOP_glyph_cache_unlink(cache, index);
+        ATOP_glyph_entry *victim = &cache->entries[index];
+        int *link = &cache->hash[ATOP_glyph_hash(victim->code, victim->fgcolor, victim->bgcolor)];
+        while (*link != index) {
+            link = &cache->entries[*link].hash_next;
+        }
+        *link = victim->hash_next;
+    }
+
+    ATOP_glyph_entry *entry = &cache->entries[index];
+    entry->code = code;
+    entry->fgcolor = fgcolor;
+    entry->bgcolor = bgcolor;
+    entry->hash_next = cache->hash[hash];
+    cache->hash[hash] = index;
+    ATOP_glyph_cache_push(cache, index);
+
+    int bw = self->font_w * width, bh = self->line_height;
+    uint32_t *block = cache->pixels + index * cache->entry_size;
+    for (int i = 0; i < bw * bh; i++) {
+        block[i] = bgcolor;
+    }
+    if (pattern) {
+        int x = 0, y = self->font_offset, w = font->w, h = font->h;
+        ATOP_rotate_rect(self->rotate, bw, bh, &x, &y, &w, &h);
+        int pitch = (self->rotate & 1) ? bh : bw;
+        if (font->bpp == 8) {
+            ATOP_draw_coverage(block + y * pitch + x, pitch, pattern, font->w8, w, h, fgcolor, bgcolor);
         } else {
-            return INVALID_UNICHAR;
+            ATOP_draw_pattern(block + y * pitch + x, pitch, pattern, font->w8, w, h, fgcolor, bgcolor);
         }
+    }
+    return block;
+}
+
+static void ATOP_draw_glyph(ATOP_Context *self, int x, int y, uint32_t code, int width, const ATOP_font *font, intptr_t glyph, uint32_t fgcolor, uint32_t bgcolor) {
+    if (x < 0 || x + width > self->cols || y < 0 || y >= self->rows) return;
+    const uint32_t *block = ATOP_get_glyph(self, code, width, font, glyph, fgcolor, bgcolor);
+    if (block) {
+        ATOP_put_block(self, ATOP_col_to_x(self, x), ATOP_row_to_y(self, y), self->font_w * width, self->line_height, block);
+        self->stat.glyphs++;
+        if (width > 1) self->stat.wide_glyphs++;
+    } else {
+        ATOP_fill_block(self, x, y, width, 1, bgcolor);
+    }
+}
+
+static void ATOP_draw_char(ATOP_Context *self, int x, int y, uint32_t c, uint32_t fgcolor, uint32_t bgcolor) {
+    ATOP_draw_glyph(self, x, y, c, 1, &self->font, c - 0x20, fgcolor, bgcolor);
+}
+
+static void ATOP_draw_widechar(ATOP_Context *self, int x, int y, uint32_t c, uint32_t fgcolor, uint32_t bgcolor) {
+    intptr_t glyph = cp932_font_find(c);
+    if (glyph >= 0) {
+        ATOP_draw_glyph(self, x, y, c, 2, &self->wide_font, glyph, fgcolor, bgcolor);
+    } else {
+        ATOP_fill_block(self, x, y, 2, 1, fgcolor);
+    }
+}
+
+static void ATOP_draw_cell(ATOP_Context *self, int x, int y, const ATOP_cell *cell) {
+    uint32_t fgcolor = self->palette[cell->attr & 0x0F];
+    uint32_t bgcolor = self->palette[(cell->attr >> 4) & 0x0F];
+    if (cell->flags & ATOP_CELL_WIDE) {
+        ATOP_draw_widechar(self, x, y, cell->code, fgcolor, bgcolor);
+    } else if (cell->code == INVALID_UNICHAR) {
+        ATOP_draw_char(self, x, y, '?', bgcolor, fgcolor);
+    } else {
+        ATOP_draw_char(self, x, y, cell->code, fgcolor, bgcolor);
+    }
+}
+
+
+//  Logical row y lives in ring row (top_row + y) of the cell grid
+static int ATOP_ring_row(ATOP_Context *self, int y) {
+    int ring = self->top_row + y;
+    return (ring < self->rows) ? ring : ring - self->rows;
+}
+
+static ATOP_cell *ATOP_line(ATOP_Context *self, int y) {
+    return self->cells + ATOP_ring_row(self, y) * self->cols;
+}
+
+static void ATOP_invalidate_ring(ATOP_Context *self, int ring, int x, int w) {
+    ATOP_span *span = self->row_dirty + ring;
+    if (span->right <= span->left) {
+        span->left = x;
+        span->right = x + w;
     } else {
-        return INVALID_UNICHAR;
+        if (span->left > x) span->left = x;
+        if (span->right < x + w) span->right = x + w;
+    }
+}
+
+static void ATOP_invalidate(ATOP_Context *self, int x, int y, int w) {
+    ATOP_invalidate_ring(self, ATOP_ring_row(self, y), x, w);
+}
+
+//  Screen row y while the view is moved back by view_offset lines, into the scrollback when above the live screen
+static ATOP_cell *ATOP_view_line(ATOP_Context *self, int y) {
+    int back = self->view_offset - y;
+    if (back <= 0) return ATOP_line(self, -back);
+    int index = self->history_head - back;
+    if (index < 0) index += ATOP_SCROLLBACK_LINES;
+    return self->history + index * self->cols;
+}
+
+//  Repaint every row from the cells, the pixels on the screen being of no use
+static void ATOP_invalidate_all(ATOP_Context *self) {
+    for (int i = 0; i < self->rows; i++) {
+        ATOP_invalidate_ring(self, i, 0, self->cols);
+    }
+    self->pending_scroll = 0;
+}
+
+static void ATOP_history_push(ATOP_Context *self, const ATOP_cell *line) {
+    if (!self->history) return;
+    memcpy(self->history + self->history_head * self->cols, line, sizeof(ATOP_cell) * self->cols);
+    if (++self->history_head >= ATOP_SCROLLBACK_LINES) self->history_head = 0;
+    if (self->history_count < ATOP_SCROLLBACK_LINES) self->history_count++;
+}
+
+//  Output brings back the live screen
+static void ATOP_view_live(ATOP_Context *self) {
+    if (!self->view_offset) return;
+    self->view_offset = 0;
+    ATOP_invalidate_all(self);
+}
+
+static void ATOP_clear_line(ATOP_Context *self, int y) {
+    ATOP_cell blank = { ' ', self->mode.Attribute, 0 };
+    ATOP_cell *line = ATOP_line(self, y);
+    for (int i = 0; i < self->cols; i++) {
+        line[i] = blank;
     }
+    ATOP_invalidate(self, 0, y, self->cols);
 }
 
-static void ATOP_draw_char(ATOP_Context *self, int x, int y, wchar_t c, uint32_t color) {
+static void ATOP_put_cell(ATOP_Context *self, int x, int y, uint32_t code, int flags) {
     if (x < 0 || x >= self->cols || y < 0 || y >= self->rows) return;
-    const uint8_t *font = self->font_data + (c - 0x20) * (self->font_w8 * self->font_h);
-    ATOP_draw_pattern(self, ATOP_col_to_x(self, x), ATOP_row_to_y(self, y) + self->font_offset, self->font_w, self->font_h, font, color);
-}
-
-static void ATOP_draw_widechar(ATOP_Context *self, int x, int y, wchar_t c, uint32_t color){
-    if (x < 0 || x >= self->cols - 1 || y < 0 || y >= self->rows) return;
-    intptr_t font_size = font_zn.font_w8 * font_zn.font_h;
-    for (int ti = 0; ti < font_zn.tbl_cnt; ti++) {
-        if (c < font_zn.table[ti].begin) {
-            break;
-        } else if (c >= font_zn.table[ti].begin && c <= font_zn.table[ti].end) {
-            uint8_t *p = font_zn.rawPtr + font_zn.table[ti].off + (c - font_zn.table[ti].begin) * font_size;
-            ATOP_draw_pattern(self, ATOP_col_to_x(self, x), ATOP_row_to_y(self, y) + self->font_offset, font_zn.font_w, font_zn.font_h, p, color);
-            return;
-        }
+    ATOP_cell *line = ATOP_line(self, y);
+
+    //  Nothing to repaint if the cell already holds the same glyph and color
+    if (line[x].code == code && line[x].attr == (uint8_t)self->mode.Attribute && line[x].flags == flags) return;
+
+    //  Break up a double width glyph that is partially overwritten
+    if ((line[x].flags & ATOP_CELL_TAIL) && !(flags & ATOP_CELL_TAIL)) {
+        line[x - 1].code = ' ';
+        line[x - 1].flags = 0;
+        ATOP_invalidate(self, x - 1, y, 1);
     }
-    ATOP_fill_block(self, x, y, 3, 1, color);
+    if ((line[x].flags & ATOP_CELL_WIDE) && !(flags & ATOP_CELL_WIDE) && x + 1 < self->cols) {
+        line[x + 1].code = ' ';
+        line[x + 1].flags = 0;
+        ATOP_invalidate(self, x + 1, y, 1);
+    }
+
+    line[x].code = code;
+    line[x].attr = self->mode.Attribute;
+    line[x].flags = flags;
+    ATOP_invalidate(self, x, y, 1);
 }
 
+
 static int ATOP_set_cursor_visible(ATOP_Context *self, int visible) {
     int old_value = self->mode.CursorVisible;
     self->mode.CursorVisible = visible;
-    if (self->mode.CursorColumn < self->cols && self->mode.CursorRow < self->rows) {
-        int cursor_height = 2;
-        int x = ATOP_col_to_x(self, self->mode.CursorColumn);
-        int y = ATOP_row_to_y(self, self->mode.CursorRow) + self->line_height - cursor_height;
-        int w = self->font_w;
-        int h = cursor_height;
-        if (visible) {
-            ATOP_fill_rect(self, x, y, w, h, self->fgcolor);
-        } else if (old_value) {
-            ATOP_fill_rect(self, x, y, w, h, self->bgcolor);
+    return old_value;
+}
+
+
+static void ATOP_move_pixels(uint32_t *dst, const uint32_t *src, intptr_t n) {
+    if (dst < src) {
+        for (intptr_t i = 0; i < n; i++) {
+            dst[i] = src[i];
+        }
+    } else {
+        for (intptr_t i = n - 1; i >= 0; i--) {
+            dst[i] = src[i];
         }
     }
-    return old_value;
 }
 
+//  Move the text area up by some lines at once
+static void ATOP_scroll_pixels(ATOP_Context *self, int lines) {
+    int dy = lines * self->line_height;
+    int tx = ATOP_col_to_x(self, 0), ty = ATOP_row_to_y(self, 0);
+    int sx = tx, sy = ty + dy;
+    int w = self->cols * self->font_w, h = self->rows * self->line_height - dy;
+    int tw = w, th = h;
+    ATOP_rotate_rect(self->rotate, self->screen_w, self->screen_h, &sx, &sy, &w, &h);
+    ATOP_rotate_rect(self->rotate, self->screen_w, self->screen_h, &tx, &ty, &tw, &th);
+
+    //  Walk the scan lines against the direction of the move
+    int sw = self->shadow_w, step = sw;
+    uint32_t *p = self->shadow + ty * sw + tx;
+    const uint32_t *q = self->shadow + sy * sw + sx;
+    if (ty > sy) {
+        p += (h - 1) * sw;
+        q += (h - 1) * sw;
+        step = -sw;
+    }
+    for (int i = 0; i < h; i++, p += step, q += step) {
+        ATOP_move_pixels(p, q, w);
+    }
+    ATOP_mark_dirty(self, tx, ty, w, h);
+    self->stat.scroll_moves++;
+}
 
 static int ATOP_check_scroll(ATOP_Context *self) {
 
@@ -271,33 +984,86 @@ static int ATOP_check_scroll(ATOP_Context *self) {
         self->mode.CursorColumn = 0;
         self->mode.CursorRow++;
     }
-    if (self->mode.CursorRow >= self->rows) {
+    if (self->mode.CursorRow >= self->rows && self->cells) {
         self->mode.CursorRow = self->rows-1;
 
-        int x0 = ATOP_col_to_x(self, 0);
-        int y0 = ATOP_row_to_y(self, 0);
-        int y1 = y0 + self->line_height;
-        int w0 = self->cols * self->font_w;
-        int h0 = (self->rows-1) * self->line_height;
-
-        if (self->rotate) {
-            int sw = self->gop->Mode->Info->HorizontalResolution;
-            int x1 = sw - y1 - h0;
-            int z0 = x0;
-            x0 = sw - y0 - h0;
-            y0 = z0;
-            // self->gop->Blt(self->gop, NULL, EfiBltVideoToVideo, x1, y0, x0, y0, h0, w0, 0);
-            self->gop->Blt(self->gop, blt_buffer, EfiBltVideoToBltBuffer, x1, y0, 0, 0, h0, w0, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * h0);
-            self->gop->Blt(self->gop, blt_buffer, EfiBltBufferToVideo, 0, 0, x0, y0, h0, w0, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * h0);
-        } else {
-            self->gop->Blt(self->gop, NULL, EfiBltVideoToVideo, x0, y1, x0, y0, w0, h0, 0);
-        }
-        ATOP_fill_block(self, 0, self->rows-1, self->cols, 1, self->bgcolor);
+        //  Keep the top line, rotate the ring and defer the pixel move until the next update
+        ATOP_history_push(self, ATOP_line(self, 0));
+        self->top_row = ATOP_ring_row(self, 1);
+        self->pending_scroll++;
+        self->stat.scrolls++;
+        ATOP_clear_line(self, self->rows - 1);
     }
 
     return 0;
 }
 
+//  Bring the shadow buffer up to date with the cell grid
+static void ATOP_render(ATOP_Context *self) {
+    if (!self->shadow || !self->cells) return;
+
+    if (self->pending_scroll) {
+        if (self->pending_scroll < self->rows) {
+            ATOP_scroll_pixels(self, self->pending_scroll);
+        }
+        self->pending_scroll = 0;
+    }
+
+    for (int y = 0; y < self->rows; y++) {
+        ATOP_span *span = self->row_dirty + ATOP_ring_row(self, y);
+        if (span->right <= span->left) continue;
+        ATOP_cell *line = ATOP_view_line(self, y);
+        int x = span->left, r = span->right;
+        if (x > 0 && (line[x].flags & ATOP_CELL_TAIL)) x--;
+        for (; x < r; x++) {
+            if (!(line[x].flags & ATOP_CELL_TAIL)) {
+                ATOP_draw_cell(self, x, y, &line[x]);
+            }
+        }
+        span->left = span->right = 0;
+    }
+}
+
+//  The cursor is composed on the screen only, the shadow buffer never holds it.
+//  Hiding it writes back the pixels of the shadow buffer under its rectangle
+static void ATOP_cursor_paint(ATOP_Context *self, int on) {
+    if (self->cursor_shown) {
+        ATOP_write_screens(self, self->cursor_x, self->cursor_y, self->cursor_w, self->cursor_h);
+        self->cursor_shown = 0;
+    }
+    if (!on || !self->shadow || !self->mode.CursorVisible || self->view_offset) return;
+    if (self->mode.CursorColumn >= self->cols || self->mode.CursorRow >= self->rows) return;
+
+    int cursor_height = 2 * self->scale;
+    int x = ATOP_col_to_x(self, self->mode.CursorColumn);
+    int y = ATOP_row_to_y(self, self->mode.CursorRow) + self->line_height - cursor_height;
+    int w = self->font_w, h = cursor_height;
+    ATOP_rotate_rect(self->rotate, self->screen_w, self->screen_h, &x, &y, &w, &h);
+    ATOP_fill_screens(self, self->fgcolor, x, y, w, h);
+    self->cursor_x = x;
+    self->cursor_y = y;
+    self->cursor_w = w;
+    self->cursor_h = h;
+    self->cursor_shown = 1;
+}
+
+//  Blink the cursor. It runs at TPL_CALLBACK, and updates of the screen raise the TPL above it
+static VOID EFIAPI ATOP_cursor_tick(IN EFI_EVENT Event, IN VOID *Context) {
+    ATOP_Context *self = Context;
+    self->cursor_phase = !self->cursor_phase;
+    ATOP_cursor_paint(self, self->cursor_phase);
+}
+
+static void ATOP_update(ATOP_Context *self) {
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    ATOP_render(self);
+    ATOP_flush(self);
+
+    //  Bring a shown cursor along to where the text left it
+    if (self->cursor_shown) ATOP_cursor_paint(self, 1);
+    gBS->RestoreTPL(tpl);
+}
+
 
 static EFI_STATUS ATOP_putchar(ATOP_Context *self, wchar_t c) {
     EFI_STATUS retval = EFI_SUCCESS;
@@ -312,21 +1078,21 @@ static EFI_STATUS ATOP_putchar(ATOP_Context *self, wchar_t c) {
     switch (u) {
     default:
         if (u < 0x100) {
-            ATOP_fill_block(self, self->mode.CursorColumn, self->mode.CursorRow, 1, 1, self->bgcolor);
-            if (c > 0x20) {
-                ATOP_draw_char(self, self->mode.CursorColumn, self->mode.CursorRow, u, self->fgcolor);
-            }
+            ATOP_put_cell(self, self->mode.CursorColumn, self->mode.CursorRow, (c > 0x20) ? u : ' ', 0);
             self->mode.CursorColumn++;
         } else {
-            ATOP_fill_block(self, self->mode.CursorColumn, self->mode.CursorRow, 2, 1, self->bgcolor);
-            ATOP_draw_widechar(self, self->mode.CursorColumn, self->mode.CursorRow, u, self->fgcolor);
+            if (self->mode.CursorColumn < self->cols - 1) {
+                ATOP_put_cell(self, self->mode.CursorColumn, self->mode.CursorRow, u, ATOP_CELL_WIDE);
+                ATOP_put_cell(self, self->mode.CursorColumn + 1, self->mode.CursorRow, u, ATOP_CELL_TAIL);
+            } else {
+                ATOP_put_cell(self, self->mode.CursorColumn, self->mode.CursorRow, ' ', 0);
+            }
             self->mode.CursorColumn += 2;
         }
         break;
     case INVALID_UNICHAR:
         {
-            ATOP_fill_block(self, self->mode.CursorColumn, self->mode.CursorRow, 1, 1, self->fgcolor);
-            ATOP_draw_char(self, self->mode.CursorColumn, self->mode.CursorRow, '?', self->bgcolor);
+            ATOP_put_cell(self, self->mode.CursorColumn, self->mode.CursorRow, INVALID_UNICHAR, 0);
             self->mode.CursorColumn++;
         }
         break;
@@ -350,6 +1116,59 @@ static EFI_STATUS ATOP_putchar(ATOP_Context *self, wchar_t c) {
 }
 
 
+//  Largest scale up to the one for the resolution that still fits the text mode on the screen
+static int ATOP_choose_scale(ATOP_Context *self, int w, int h) {
+#if ATOP_SCALE > 0
+    int scale = ATOP_SCALE;
+#else
+    int scale = w / ATOP_SCALE_WIDTH;
+    if (scale > h / ATOP_SCALE_HEIGHT) scale = h / ATOP_SCALE_HEIGHT;
+#endif
+    if (scale > ATOP_SCALE_MAX) scale = ATOP_SCALE_MAX;
+    int line_height = FONT_PROPERTY(height) + ((FONT_PROPERTY(height) * 3) >> 4);
+    while (scale > 1 && (self->mode_cols * FONT_PROPERTY(width) * scale > w || self->mode_rows * line_height * scale > h)) {
+        scale--;
+    }
+    return (scale < 1) ? 1 : scale;
+}
+
+//  Metrics of a cell at an integer scale, with the glyphs expanded to it once.
+//  The anti-aliased font is used when the pixels of the mode can be blended byte by byte
+static void ATOP_set_scale(ATOP_Context *self, int scale) {
+#ifdef AAFONT_WIDTH
+    int smooth = gop_pixel_blendable(&self->pixel);
+#else
+    int smooth = 0;
+#endif
+    if (self->scale == scale && self->smooth == smooth) return;
+    self->scale = scale;
+    self->smooth = smooth;
+
+    int line_height = FONT_PROPERTY(height) + ((FONT_PROPERTY(height) * 3) >> 4);
+    self->font_w = FONT_PROPERTY(width) * scale;
+    self->font_h = FONT_PROPERTY(height) * scale;
+    self->line_height = line_height * scale;
+    self->font_offset = ((line_height - FONT_PROPERTY(height)) / 2) * scale;
+
+    //	Prepare the glyphs in the scan order of the screen
+    const uint8_t *data = (const uint8_t *)FONT_PROPERTY(fontdata);
+    int bpp = 1, count = sizeof(FONT_PROPERTY(fontdata)) / sizeof(FONT_PROPERTY(fontdata)[0]);
+    int src_w = FONT_PROPERTY(width), src_h = FONT_PROPERTY(height);
+#ifdef AAFONT_WIDTH
+    if (smooth) {
+        data = (const uint8_t *)aafont_data;
+        bpp = 8;
+        count = sizeof(aafont_data) / sizeof(aafont_data[0]);
+        src_w = AAFONT_WIDTH;
+        src_h = AAFONT_HEIGHT;
+    }
+#endif
+    ATOP_font_init(&self->font, self->rotate, scale, bpp, data, NULL, count,
+        src_w, src_h, self->font_w, self->line_height - self->font_offset);
+    ATOP_font_init(&self->wide_font, self->rotate, scale, 1, font_zn.glyphs, cp932_font_glyph, font_zn.glyph_cnt,
+        font_zn.font_w, font_zn.font_h, self->font_w * 2, self->line_height - self->font_offset);
+}
+
 
 static EFI_STATUS EFIAPI ATOP_RESET (
     IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This,
@@ -358,18 +1177,42 @@ static EFI_STATUS EFIAPI ATOP_RESET (
     ATOP_Context *self = ATOP_unboxing(This);
     if(!self) return EFI_DEVICE_ERROR;
 
-    EFI_GRAPHICS_OUTPUT_BLT_PIXEL zero = {0, 0, 0, 0};
-    self->gop->Blt(self->gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)&zero, EfiBltVideoFill,
-        0, 0, 0, 0, self->gop->Mode->Info->HorizontalResolution, self->gop->Mode->Info->VerticalResolution, 0);
+    //  The old shadow buffer can't restore the screen under the cursor any more
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    self->cursor_shown = 0;
+
+    self->shadow_w = self->gop->Mode->Info->HorizontalResolution;
+    self->shadow_h = self->gop->Mode->Info->VerticalResolution;
+    intptr_t shadow_size = sizeof(uint32_t) * self->shadow_w * self->shadow_h;
+    if (self->shadow_size < shadow_size) {
+        free(self->shadow);
+        self->shadow = malloc(shadow_size);
+        if (!self->shadow) {
+            self->shadow_w = self->shadow_h = self->shadow_size = 0;
+            gBS->RestoreTPL(tpl);
+            return EFI_OUT_OF_RESOURCES;
+        }
+        self->shadow_size = shadow_size;
+    }
+    memset(self->shadow, 0, shadow_size);
+    ATOP_mark_dirty(self, 0, 0, self->shadow_w, self->shadow_h);
+
+    //  The shadow buffer holds pixels in the native format of the current mode
+    gop_pixel_format_init(&self->pixel, self->gop);
+    gop_convert_pixels(&self->pixel, self->palette, palette, 16);
+    for (int i = 0; i < self->n_mirrors; i++) {
+        ATOP_mirror_reset(self, self->mirrors + i);
+    }
+    self->bgcolor = self->palette[(self->mode.Attribute >> 4) & 0xF];
+    self->fgcolor = self->palette[self->mode.Attribute & 0x0F];
 
     int scrW, scrH;
-    if (self->rotate) {
-        scrW = self->gop->Mode->Info->VerticalResolution;
-        scrH = self->gop->Mode->Info->HorizontalResolution;
-    } else {
-        scrH = self->gop->Mode->Info->VerticalResolution;
-        scrW = self->gop->Mode->Info->HorizontalResolution;
-    }
+    ATOP_get_screen_size(self, &scrW, &scrH);
+    self->screen_w = scrW;
+    self->screen_h = scrH;
+
+    ATOP_set_scale(self, ATOP_choose_scale(self, scrW, scrH));
+    ATOP_glyph_cache_reset(self);
 
     self->cols = self->mode_cols;
     if (!self->cols) self->cols = scrW / self->font_w;
@@ -379,6 +1222,27 @@ static EFI_STATUS EFIAPI ATOP_RESET (
     self->padding_x = ((scrW - (self->cols * self->font_w)) / 2) & ~3;
     self->padding_y = ((scrH - (self->rows * self->line_height)) / 2) & ~3;
 
+    intptr_t cells_size = (sizeof(ATOP_cell) * self->cols + sizeof(ATOP_span)) * self->rows;
+    if (self->cells_size < cells_size) {
+        free(self->cells);
+        self->cells = malloc(cells_size);
+        self->cells_size = self->cells ? cells_size : 0;
+    }
+    gBS->RestoreTPL(tpl);
+    if (!self->cells) return EFI_OUT_OF_RESOURCES;
+    self->row_dirty = (ATOP_span *)(self->cells + self->cols * self->rows);
+    memset(self->row_dirty, 0, sizeof(ATOP_span) * self->rows);
+
+    //  The scrollback is allocated here only, lines that scroll off are copied into it.
+    //  Its lines have the width of the mode, so a new mode starts it over
+    intptr_t history_size = sizeof(ATOP_cell) * self->cols * ATOP_SCROLLBACK_LINES;
+    if (self->history_size < history_size) {
+        free(self->history);
+        self->history = malloc(history_size);
+        self->history_size = self->history ? history_size : 0;
+    }
+    self->history_head = self->history_count = self->view_offset = 0;
+
     This->ClearScreen(This);
 
     return EFI_SUCCESS;
@@ -391,12 +1255,15 @@ static EFI_STATUS EFIAPI ATOP_OUTPUT_STRING (
     ATOP_Context *self = ATOP_unboxing(This);
     if(!self) return EFI_DEVICE_ERROR;
 
-    int old_cursor_state = ATOP_set_cursor_visible(self, 0);
+    uint64_t t0 = cpu_ticks();
+    ATOP_view_live(self);
     EFI_STATUS retVal = 0;
     for (CONST CHAR16 *p = String; *p; p++) {
         retVal |= ATOP_putchar(self, *p);
     }
-    ATOP_set_cursor_visible(self, old_cursor_state);
+    ATOP_update(self);
+    self->stat.outputs++;
+    self->stat.output_ticks += cpu_ticks() - t0;
 
     return retVal;
 }
@@ -452,15 +1319,9 @@ static EFI_STATUS EFIAPI ATOP_SET_MODE (
         coords mode = mode_templates[ModeNumber];
         if (mode.cols > 0 && mode.rows > 0) {
             int scrW, scrH;
-            if (self->rotate) {
-                scrW = self->gop->Mode->Info->VerticalResolution;
-                scrH = self->gop->Mode->Info->HorizontalResolution;
-            } else {
-                scrH = self->gop->Mode->Info->VerticalResolution;
-                scrW = self->gop->Mode->Info->HorizontalResolution;
-            }
+            ATOP_get_screen_size(self, &scrW, &scrH);
             int fw = scrW / mode.cols, fh = scrH / mode.rows;
-            if (fw < self->font_w || fh < self->font_h) {
+            if (fw < FONT_PROPERTY(width) || fh < FONT_PROPERTY(height)) {
                 return EFI_UNSUPPORTED;
             }
         }
@@ -481,11 +1342,10 @@ static EFI_STATUS EFIAPI ATOP_SET_ATTRIBUTE (
 
     if (Attribute == 0) Attribute = DEFAULT_COLOR;
 
-    int old_cursor_state = ATOP_set_cursor_visible(self, 0);
     This->Mode->Attribute = Attribute;
-    self->bgcolor = palette[(Attribute >> 4) & 0xF];
-    self->fgcolor = palette[Attribute & 0x0F];
-    ATOP_set_cursor_visible(self, old_cursor_state);
+    self->bgcolor = self->palette[(Attribute >> 4) & 0xF];
+    self->fgcolor = self->palette[Attribute & 0x0F];
+    ATOP_update(self);
 
     return EFI_SUCCESS;
 }
@@ -496,10 +1356,17 @@ static EFI_STATUS EFIAPI ATOP_CLEAR_SCREEN (
     ATOP_Context *self = ATOP_unboxing(This);
     if (!self) return EFI_DEVICE_ERROR;
 
-    This->SetCursorPosition(This, 0, 0);
-    {
-        ATOP_fill_block(self, 0, 0, self->cols, self->rows, self->bgcolor);
+    self->mode.CursorColumn = 0;
+    self->mode.CursorRow = 0;
+    self->view_offset = 0;
+    if (self->cells) {
+        self->top_row = 0;
+        self->pending_scroll = 0;
+        for (int i = 0; i < self->rows; i++) {
+            ATOP_clear_line(self, i);
+        }
     }
+    ATOP_update(self);
 
     return EFI_SUCCESS;
 }
@@ -512,10 +1379,9 @@ static EFI_STATUS EFIAPI ATOP_SET_CURSOR_POSITION (
     ATOP_Context *self = ATOP_unboxing(This);
     if (!self) return EFI_DEVICE_ERROR;
 
-    int old_cursor_state = ATOP_set_cursor_visible(self, 0);
     self->mode.CursorColumn = Column;
     self->mode.CursorRow = Row;
-    ATOP_set_cursor_visible(self, old_cursor_state);
+    ATOP_update(self);
 
     return EFI_SUCCESS;
 }
@@ -528,14 +1394,130 @@ static EFI_STATUS EFIAPI ATOP_ENABLE_CURSOR (
     if (!self) return EFI_DEVICE_ERROR;
 
     ATOP_set_cursor_visible(self, Visible);
+    ATOP_update(self);
+
+    //  Blink by a periodic timer while the cursor is visible
+    if (Visible) {
+        if (!self->cursor_timer) {
+            gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_CALLBACK, ATOP_cursor_tick, self, &self->cursor_timer);
+        }
+        if (self->cursor_timer) {
+            gBS->SetTimer(self->cursor_timer, TimerPeriodic, ATOP_CURSOR_BLINK);
+        }
+    } else if (self->cursor_timer) {
+        gBS->SetTimer(self->cursor_timer, TimerCancel, 0);
+    }
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    self->cursor_phase = Visible;
+    ATOP_cursor_paint(self, Visible);
+    gBS->RestoreTPL(tpl);
 
     return EFI_SUCCESS;
 }
 
 
+EFI_STATUS ATOP_get_glyph_cache_stat(
+    IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text,
+    OUT ATOP_glyph_cache_stat* result
+) {
+    if (!text || text->OutputString != ATOP_OUTPUT_STRING) return EFI_UNSUPPORTED;
+    ATOP_Context *self = ATOP_unboxing(text);
+
+    result->size = ATOP_GLYPH_CACHE_SIZE;
+    result->used = self->glyph_cache.used;
+    result->hits = self->glyph_cache.hits;
+    result->misses = self->glyph_cache.misses;
+
+    return EFI_SUCCESS;
+}
+
+
+EFI_STATUS ATOP_get_render_stat(
+    IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text,
+    OUT ATOP_render_stat* result
+) {
+    if (!text || text->OutputString != ATOP_OUTPUT_STRING) return EFI_UNSUPPORTED;
+    ATOP_Context *self = ATOP_unboxing(text);
+
+    *result = self->stat;
+
+    return EFI_SUCCESS;
+}
+
+
+//  Move the view back into the scrollback by some lines, or forward if negative.
+//  The view returns to the live screen when anything is written. EFI_NOT_FOUND if the view can't move
+EFI_STATUS ATOP_scroll_view(
+    IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text,
+    IN intptr_t lines
+) {
+    if (!text || text->OutputString != ATOP_OUTPUT_STRING) return EFI_UNSUPPORTED;
+    ATOP_Context *self = ATOP_unboxing(text);
+    if (!self->cells) return EFI_NOT_READY;
+
+    intptr_t view_offset = self->view_offset;
+    if (lines > self->history_count - view_offset) {
+        view_offset = self->history_count;
+    } else if (lines < -view_offset) {
+        view_offset = 0;
+    } else {
+        view_offset += lines;
+    }
+    if (view_offset == self->view_offset) return EFI_NOT_FOUND;
+
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    ATOP_cursor_paint(self, 0);
+    self->view_offset = view_offset;
+    ATOP_invalidate_all(self);
+    ATOP_update(self);
+    gBS->RestoreTPL(tpl);
+
+    return EFI_SUCCESS;
+}
+
+
+//  Show the screen on another display as well. The text keeps the layout of the first display
+EFI_STATUS ATOP_add_mirror(
+    IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text,
+    IN EFI_GRAPHICS_OUTPUT_PROTOCOL* gop
+) {
+    if (!text || text->OutputString != ATOP_OUTPUT_STRING || !gop) return EFI_UNSUPPORTED;
+    ATOP_Context *self = ATOP_unboxing(text);
+    if (gop == self->gop) return EFI_INVALID_PARAMETER;
+    if (self->n_mirrors >= ATOP_MAX_MIRRORS) return EFI_OUT_OF_RESOURCES;
+
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    ATOP_mirror *mirror = self->mirrors + self->n_mirrors++;
+    mirror->gop = gop;
+    ATOP_mirror_reset(self, mirror);
+    if (mirror->active && self->shadow) {
+        gop_write_pixels(&mirror->pixel, self->shadow, self->shadow_w, mirror->offset_x, mirror->offset_y, self->shadow_w, self->shadow_h);
+        if (self->cursor_shown) {
+            gop_fill_pixels(&mirror->pixel, self->fgcolor, self->cursor_x + mirror->offset_x, self->cursor_y + mirror->offset_y, self->cursor_w, self->cursor_h);
+        }
+    }
+    gBS->RestoreTPL(tpl);
+
+    return mirror->active ? EFI_SUCCESS : EFI_UNSUPPORTED;
+}
+
+
 static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL static_stop;
 static ATOP_Context static_context;
 
+//  Buffers and the timer of a context set up before, so ATOP_init can run again on a new mode
+static void ATOP_release(ATOP_Context *self) {
+    if (self->cursor_timer) gBS->CloseEvent(self->cursor_timer);
+    free(self->shadow);
+    free(self->cells);
+    free(self->history);
+    free(self->glyph_cache.pixels);
+    free(self->font.atlas);
+    free(self->font.scratch);
+    free(self->wide_font.atlas);
+    free(self->wide_font.scratch);
+}
+
 
 EFIAPI EFI_STATUS ATOP_init(
     IN EFI_GRAPHICS_OUTPUT_PROTOCOL* gop,
@@ -545,6 +1527,7 @@ EFIAPI EFI_STATUS ATOP_init(
     if (!gop) return EFI_DEVICE_ERROR;
 
     ATOP_Context *ctx = &static_context;
+    ATOP_release(ctx);
     memset(ctx, 0, sizeof(ATOP_Context));
     EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *buffer = &static_stop;
     memset(buffer, 0, sizeof(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL));
@@ -554,13 +1537,6 @@ EFIAPI EFI_STATUS ATOP_init(
     ctx->mode.MaxMode = sizeof(mode_templates) / sizeof(mode_templates[0]);
     ctx->mode.Mode = -1;
 
-    ctx->font_w = FONT_PROPERTY(width);
-    ctx->font_h = FONT_PROPERTY(height);
-    ctx->font_w8 = (FONT_PROPERTY(width) + 7) / 8;
-    ctx->font_data = (const uint8_t *)FONT_PROPERTY(fontdata);
-    ctx->line_height = FONT_PROPERTY(height) + ((FONT_PROPERTY(height) * 3) >> 4);
-    ctx->font_offset = (ctx->line_height - FONT_PROPERTY(height)) / 2;
-
     buffer->Mode = (SIMPLE_TEXT_OUTPUT_MODE *)ctx;
     buffer->Reset = ATOP_RESET;
     buffer->OutputString = ATOP_OUTPUT_STRING;
@@ -573,6 +1549,7 @@ EFIAPI EFI_STATUS ATOP_init(
     buffer->EnableCursor = ATOP_ENABLE_CURSOR;
 
     //	Set rotation
+#if ATOP_ROTATION < 0
     {
         UINTN sizeOfInfo;
         EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info;
@@ -580,12 +1557,10 @@ EFIAPI EFI_STATUS ATOP_init(
         if (info->HorizontalResolution < info->VerticalResolution) {
             ctx->rotate = 1;
         }
-    // ctx->rotate = 1; // for DEBUG
-    }
-
-    if (ctx->rotate) {
-        blt_buffer = malloc(sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * gop->Mode->Info->HorizontalResolution * gop->Mode->Info->PixelsPerScanLine);
     }
+#else
+    ctx->rotate = (ATOP_ROTATION / 90) & 3;
+#endif
 
     buffer->SetAttribute(buffer, DEFAULT_COLOR);
     buffer->SetMode(buffer, 0);
@@ -0,0 +1,60 @@
+// Glyph expansion and blending kernels (NEON)
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include <arm_neon.h>
+#include "osldr.h"
+
+
+//  Expand w pixels of a 1bpp pattern (MSB first) into 32bpp pixels
+void glyph_expand(uint32_t* dst, const uint8_t* pattern, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    static const uint32_t masks[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    const uint32x4_t mask_lo = vld1q_u32(masks);
+    const uint32x4_t mask_hi = vld1q_u32(masks + 4);
+    const uint32x4_t fg = vdupq_n_u32(fgcolor);
+    const uint32x4_t bg = vdupq_n_u32(bgcolor);
+
+    for (; w >= 8; w -= 8, dst += 8) {
+        uint32x4_t b = vdupq_n_u32(*pattern++);
+        vst1q_u32(dst + 0, vbslq_u32(vtstq_u32(b, mask_lo), fg, bg));
+        vst1q_u32(dst + 4, vbslq_u32(vtstq_u32(b, mask_hi), fg, bg));
+    }
+    if (w > 0) {
+        uint8_t bits = *pattern;
+        for (int i = 0; i < w; i++) {
+            dst[i] = (bits & (0x80 >> i)) ? fgcolor : bgcolor;
+        }
+    }
+}
+
+//  fg over bg at coverage a / 255, two channels per multiply
+static uint32_t glyph_blend_pixel(uint32_t fgcolor, uint32_t bgcolor, uint32_t a) {
+    uint32_t rb = (fgcolor & 0x00FF00FF) * a + (bgcolor & 0x00FF00FF) * (255 - a) + 0x00800080;
+    uint32_t ag = ((fgcolor >> 8) & 0x00FF00FF) * a + ((bgcolor >> 8) & 0x00FF00FF) * (255 - a) + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = ((ag + ((ag >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    return rb | (ag << 8);
+}
+
+//  Blend w pixels of 8bpp coverage into 32bpp pixels, 4 pixels of 8 bit channels at a time
+void glyph_blend(uint32_t* dst, const uint8_t* coverage, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    static const uint8_t spread[16] = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    const uint8x16_t index = vld1q_u8(spread);
+    const uint8x16_t fg = vreinterpretq_u8_u32(vdupq_n_u32(fgcolor));
+    const uint8x16_t bg = vreinterpretq_u8_u32(vdupq_n_u32(bgcolor));
+    const uint16x8_t half = vdupq_n_u16(128);
+
+    for (; w >= 4; w -= 4, dst += 4, coverage += 4) {
+        uint32_t a4 = coverage[0] | (coverage[1] << 8) | (coverage[2] << 16) | ((uint32_t)coverage[3] << 24);
+        uint8x16_t a = vqtbl1q_u8(vreinterpretq_u8_u32(vdupq_n_u32(a4)), index);
+        uint8x16_t na = vmvnq_u8(a);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(fg), vget_low_u8(a)), vget_low_u8(bg), vget_low_u8(na));
+        uint16x8_t hi = vmlal_high_u8(vmull_high_u8(fg, a), bg, na);
+        lo = vaddq_u16(lo, half);
+        hi = vaddq_u16(hi, half);
+        uint8x16_t c = vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+        vst1q_u32(dst, vreinterpretq_u32_u8(c));
+    }
+    for (intptr_t i = 0; i < w; i++) {
+        dst[i] = glyph_blend_pixel(fgcolor, bgcolor, coverage[i]);
+    }
+}
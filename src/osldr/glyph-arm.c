@@ -0,0 +1,4 @@
+// Glyph expansion and blending kernels (generic, as on ia32)
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include "glyph-ia32.c"
@@ -0,0 +1,38 @@
+// Glyph expansion and blending kernels (generic)
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include "osldr.h"
+
+
+//  Expand w pixels of a 1bpp pattern (MSB first) into 32bpp pixels
+void glyph_expand(uint32_t* dst, const uint8_t* pattern, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    for (; w >= 8; w -= 8, dst += 8) {
+        uint8_t bits = *pattern++;
+        for (int i = 0; i < 8; i++) {
+            dst[i] = (bits & (0x80 >> i)) ? fgcolor : bgcolor;
+        }
+    }
+    if (w > 0) {
+        uint8_t bits = *pattern;
+        for (int i = 0; i < w; i++) {
+            dst[i] = (bits & (0x80 >> i)) ? fgcolor : bgcolor;
+        }
+    }
+}
+
+//  fg over bg at coverage a / 255, two channels per multiply
+static uint32_t glyph_blend_pixel(uint32_t fgcolor, uint32_t bgcolor, uint32_t a) {
+    uint32_t rb = (fgcolor & 0x00FF00FF) * a + (bgcolor & 0x00FF00FF) * (255 - a) + 0x00800080;
+    uint32_t ag = ((fgcolor >> 8) & 0x00FF00FF) * a + ((bgcolor >> 8) & 0x00FF00FF) * (255 - a) + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = ((ag + ((ag >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    return rb | (ag << 8);
+}
+
+//  Blend w pixels of 8bpp coverage into 32bpp pixels
+void glyph_blend(uint32_t* dst, const uint8_t* coverage, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    for (intptr_t i = 0; i < w; i++) {
+        uint8_t a = coverage[i];
+        dst[i] = (a == 0) ? bgcolor : (a == 255) ? fgcolor : glyph_blend_pixel(fgcolor, bgcolor, a);
+    }
+}
@@ -0,0 +1,67 @@
+// Glyph expansion and blending kernels (SSE2)
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include "osldr.h"
+
+//  Use the vector extension instead of <emmintrin.h>, which needs the hosted headers
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v4u32_u __attribute__((vector_size(16), aligned(4)));
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+
+
+//  Expand w pixels of a 1bpp pattern (MSB first) into 32bpp pixels
+void glyph_expand(uint32_t* dst, const uint8_t* pattern, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    const v4u32 mask_lo = { 0x80, 0x40, 0x20, 0x10 };
+    const v4u32 mask_hi = { 0x08, 0x04, 0x02, 0x01 };
+    const v4u32 fg = { fgcolor, fgcolor, fgcolor, fgcolor };
+    const v4u32 bg = { bgcolor, bgcolor, bgcolor, bgcolor };
+
+    for (; w >= 8; w -= 8, dst += 8) {
+        uint32_t bits = *pattern++;
+        v4u32 b = { bits, bits, bits, bits };
+        v4u32 m0 = (v4u32)((b & mask_lo) != 0);
+        v4u32 m1 = (v4u32)((b & mask_hi) != 0);
+        *(v4u32_u *)(dst + 0) = (fg & m0) | (bg & ~m0);
+        *(v4u32_u *)(dst + 4) = (fg & m1) | (bg & ~m1);
+    }
+    if (w > 0) {
+        uint8_t bits = *pattern;
+        for (int i = 0; i < w; i++) {
+            dst[i] = (bits & (0x80 >> i)) ? fgcolor : bgcolor;
+        }
+    }
+}
+
+//  fg over bg at coverage a / 255, two channels per multiply
+static uint32_t glyph_blend_pixel(uint32_t fgcolor, uint32_t bgcolor, uint32_t a) {
+    uint32_t rb = (fgcolor & 0x00FF00FF) * a + (bgcolor & 0x00FF00FF) * (255 - a) + 0x00800080;
+    uint32_t ag = ((fgcolor >> 8) & 0x00FF00FF) * a + ((bgcolor >> 8) & 0x00FF00FF) * (255 - a) + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = ((ag + ((ag >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    return rb | (ag << 8);
+}
+
+//  Blend w pixels of 8bpp coverage into 32bpp pixels.
+//  Each pixel is split into its even and odd bytes, so one 16 bit lane holds one channel.
+//  bg * 255 + (fg - bg) * a lies in 0..65025, so the lanes may wrap on the way
+void glyph_blend(uint32_t* dst, const uint8_t* coverage, intptr_t w, uint32_t fgcolor, uint32_t bgcolor) {
+    const v4u32 lo = { 0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF };
+    const v4u32 fg = { fgcolor, fgcolor, fgcolor, fgcolor };
+    const v4u32 bg = { bgcolor, bgcolor, bgcolor, bgcolor };
+    const v8u16 bg_rb = (v8u16)(bg & lo), bg_ag = (v8u16)((bg >> 8) & lo);
+    const v8u16 diff_rb = (v8u16)(fg & lo) - bg_rb, diff_ag = (v8u16)((fg >> 8) & lo) - bg_ag;
+    const v8u16 base_rb = bg_rb * 255 + 128, base_ag = bg_ag * 255 + 128;
+
+    for (; w >= 4; w -= 4, dst += 4, coverage += 4) {
+        v4u32 a32 = { coverage[0], coverage[1], coverage[2], coverage[3] };
+        v8u16 a = (v8u16)(a32 * 0x00010001);
+        v8u16 rb = base_rb + diff_rb * a;
+        v8u16 ag = base_ag + diff_ag * a;
+        rb = (rb + (rb >> 8)) >> 8;
+        ag = (ag + (ag >> 8)) >> 8;
+        *(v4u32_u *)dst = (v4u32)rb | ((v4u32)ag << 8);
+    }
+    for (intptr_t i = 0; i < w; i++) {
+        dst[i] = glyph_blend_pixel(fgcolor, bgcolor, coverage[i]);
+    }
+}
@@ -0,0 +1,123 @@
+// Packed resources for MEG-OS Loader
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include "osldr.h"
+
+//  Container: "MEGZ", size of the contents (LE32), then an LZ4 block
+#define LZ_MAGIC	0x5A47454D
+#define LZ_HEADER_SIZE	8
+
+//  Sequences end at least this far before the end of the block (LZ4 block format),
+//  so the copy loops can run 8 bytes at a time while this much is left.
+#define LZ_WILDCOPY	8
+
+void *memcpy(void *, const void *, size_t);
+void *malloc(size_t);
+void free(void *);
+
+
+static lz_stat lz_total;
+
+static uint32_t lz_read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void lz_copy8(uint8_t* dst, const uint8_t* src) {
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    memcpy(dst, &v, sizeof(v));
+}
+
+//  Length in the token, extended by 255-byte runs
+static int lz_length(const uint8_t** _ip, const uint8_t* ip_end, size_t* length) {
+    if (*length == 15) {
+        const uint8_t *ip = *_ip;
+        unsigned b;
+        do {
+            if (ip >= ip_end) return 0;
+            b = *ip++;
+            *length += b;
+        } while (b == 255);
+        *_ip = ip;
+    }
+    return 1;
+}
+
+//  Returns the size of the decoded data, or -1 if the block is broken
+intptr_t lz_decode(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size) {
+    const uint8_t *ip = src, *ip_end = src + src_size;
+    uint8_t *op = dst, *op_end = dst + dst_size;
+
+    while (ip < ip_end) {
+        unsigned token = *ip++;
+
+        size_t length = token >> 4;
+        if (!lz_length(&ip, ip_end, &length)) return -1;
+        if (length > (size_t)(ip_end - ip) || length > (size_t)(op_end - op)) return -1;
+        if ((size_t)(ip_end - ip) >= length + LZ_WILDCOPY && (size_t)(op_end - op) >= length + LZ_WILDCOPY) {
+            for (size_t i = 0; i < length; i += 8) lz_copy8(op + i, ip + i);
+        } else {
+            memcpy(op, ip, length);
+        }
+        ip += length;
+        op += length;
+
+        //  The last sequence has no match
+        if (ip >= ip_end) break;
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst)) return -1;
+
+        length = token & 15;
+        if (!lz_length(&ip, ip_end, &length)) return -1;
+        length += 4;
+        if (length > (size_t)(op_end - op)) return -1;
+
+        const uint8_t *match = op - offset;
+        if (offset >= 8 && (size_t)(op_end - op) >= length + LZ_WILDCOPY) {
+            for (size_t i = 0; i < length; i += 8) lz_copy8(op + i, match + i);
+        } else {
+            for (size_t i = 0; i < length; i++) op[i] = match[i];
+        }
+        op += length;
+    }
+
+    return op - dst;
+}
+
+int lz_is_packed(const base_and_size* data) {
+    return data->size >= LZ_HEADER_SIZE && lz_read32(data->base) == LZ_MAGIC;
+}
+
+//  Replace packed data with its contents, plain data is left as it is
+EFI_STATUS lz_unpack(base_and_size* data) {
+    if (!lz_is_packed(data)) return EFI_SUCCESS;
+
+    const uint8_t *packed = data->base;
+    size_t size = lz_read32(packed + 4);
+    uint8_t *buff = malloc(size ? size : 1);
+    if (!buff) return EFI_OUT_OF_RESOURCES;
+
+    uint64_t t0 = cpu_ticks();
+    intptr_t decoded = lz_decode(buff, size, packed + LZ_HEADER_SIZE, data->size - LZ_HEADER_SIZE);
+    lz_total.ticks += cpu_ticks() - t0;
+    if (decoded != (intptr_t)size) {
+        free(buff);
+        return EFI_LOAD_ERROR;
+    }
+
+    lz_total.files++;
+    lz_total.packed += data->size;
+    lz_total.unpacked += size;
+
+    free(data->base);
+    data->base = buff;
+    data->size = size;
+    return EFI_SUCCESS;
+}
+
+void lz_get_stat(lz_stat* result) {
+    *result = lz_total;
+}
@@ -28,32 +28,60 @@ size_t strwidth(const char* s) {
 }
 
 
+//  Lines of the console to move the scrollback by for a page
+static intptr_t scrollback_page() {
+    UINTN con_cols, con_rows;
+    if(EFI_ERROR(cout->QueryMode(cout, cout->Mode->Mode, &con_cols, &con_rows)) || con_rows < 2) {
+        return 1;
+    }
+    return con_rows - 1;
+}
+
 EFI_INPUT_KEY efi_wait_any_key(BOOLEAN reset, int ms) {
     EFI_INPUT_KEY retval = { 0, 0 };
     EFI_STATUS status;
     EFI_EVENT timer_event;
     EFI_EVENT events[2];
-    UINTN index = 0;
-    events[index++] = gST->ConIn->WaitForKey;
+    UINTN count = 0, index;
+    events[count++] = gST->ConIn->WaitForKey;
     if(ms >= 0) {
         status = gBS->CreateEvent(EVT_TIMER, 0, NULL, NULL, &timer_event);
         status = gBS->SetTimer(timer_event, TimerRelative, ms * 10000);
-        events[index++] = timer_event;
+        events[count++] = timer_event;
     }
 
     if(reset) {
         gST->ConIn->Reset(gST->ConIn, FALSE);
     }
 
-    status = gBS->WaitForEvent(index, events, &index);
-    if(!EFI_ERROR(status)) {
-        if(index == 0) {
-            EFI_INPUT_KEY key;
-            status = gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
-            if(!EFI_ERROR(status)) {
-                retval = key;
+    for(;;) {
+        status = gBS->WaitForEvent(count, events, &index);
+        if(EFI_ERROR(status) || index != 0) break;
+
+        EFI_INPUT_KEY key;
+        status = gST->ConIn->ReadKeyStroke(gST->ConIn, &key);
+        if(EFI_ERROR(status)) break;
+
+        //  Without a time limit, PAGE UP and PAGE DOWN page through the scrollback of the console,
+        //  and go to the caller when the view is already at that end
+        if(ms < 0) {
+            intptr_t lines = 0;
+            switch(key.ScanCode) {
+                case 0x09: // PAGE UP
+                    lines = scrollback_page();
+                    break;
+                case 0x0A: // PAGE DOWN
+                    lines = -scrollback_page();
+                    break;
             }
+            if(lines && !EFI_ERROR(ATOP_scroll_view(cout, lines))) continue;
         }
+
+        retval = key;
+        break;
+    }
+    if(ms < 0) {
+        ATOP_scroll_view(cout, INTPTR_MIN);
     }
 
     return retval;
@@ -145,6 +173,19 @@ void draw_title_bar(const char* title) {
 }
 
 
+static void draw_menu_item(const menuitem* item, int cur_x, int cur_y, uint32_t color, BOOLEAN selected) {
+    if(item->label) {
+        cout->SetCursorPosition(cout, cur_x, cur_y);
+        cout->SetAttribute(cout, color);
+        if(selected) {
+            printf("  > %s  ", item->label);
+        } else {
+            printf("    %s  ", item->label);
+        }
+    }
+}
+
+
 uintptr_t show_menu(menu_buffer* items, const char* title, const char* caption) {
 
     const int cur_left = 2;
@@ -153,6 +194,8 @@ uintptr_t show_menu(menu_buffer* items, const char* title, const char* caption)
     const int cur_padding = 1;
 
     int selected_index = items->selected_index;
+    int drawn_index = selected_index;
+    int items_top = cur_top;
     int redraw = 1;
 
     const uint32_t selected_item_color = 0x70;
@@ -168,25 +211,26 @@ uintptr_t show_menu(menu_buffer* items, const char* title, const char* caption)
             redraw = 0;
 
             if(caption) {
-                cout->SetCursorPosition(cout, cur_left, cur_y++);
+                cout->SetCursorPosition(cout, cur_left, cur_y);
                 cout->SetAttribute(cout, regular_item_color);
                 puts(caption);
-                cur_y += cur_padding;
+                cur_y = cout->Mode->CursorRow + cur_padding;
             }
 
+            items_top = cur_y;
             for(int i=0; i<items->item_count; i++, cur_y++) {
-                if(items->items[i].label) {
-                    cout->SetCursorPosition(cout, cur_left_item, cur_y);
-                    if(i == selected_index) {
-                        cout->SetAttribute(cout, selected_item_color);
-                        printf("  > %s  ", items->items[i].label);
-                    } else {
-                        cout->SetAttribute(cout, regular_item_color);
-                        printf("    %s  ", items->items[i].label);
-                    }
+                if(i == selected_index) {
+                    draw_menu_item(&items->items[i], cur_left_item, cur_y, selected_item_color, TRUE);
+                } else {
+                    draw_menu_item(&items->items[i], cur_left_item, cur_y, regular_item_color, FALSE);
                 }
             }
+        } else if(drawn_index != selected_index) {
+            // Only the previous and the new selection change
+            draw_menu_item(&items->items[drawn_index], cur_left_item, items_top + drawn_index, regular_item_color, FALSE);
+            draw_menu_item(&items->items[selected_index], cur_left_item, items_top + selected_index, selected_item_color, TRUE);
         }
+        drawn_index = selected_index;
 
         EFI_INPUT_KEY key = efi_wait_any_key(FALSE, -1);
         int cursor_move = 0;
@@ -223,7 +267,6 @@ uintptr_t show_menu(menu_buffer* items, const char* title, const char* caption)
                 } else {
                     selected_index = 0;
                 }
-                redraw = 1;
                 break;
 
             case 2:
@@ -234,7 +277,6 @@ uintptr_t show_menu(menu_buffer* items, const char* title, const char* caption)
                 } else {
                     selected_index = items->item_count - 1;
                 }
-                redraw = 1;
                 break;
         }
     }
@@ -9,7 +9,8 @@
 #define RES_X_MIN 800
 #define RES_Y_MIN 600
 
-#define	GOP_STANDARD_RGB	PixelBlueGreenRedReserved8BitPerColor
+#define MAX_GOP_MIRRORS 3
+
 
 #define	OS_INDICATIONS_SUPPORTED_NAME	L"OsIndicationsSupported"
 #define	OS_INDICATIONS_NAME	L"OsIndications"
@@ -22,6 +23,8 @@
 CONST CHAR16* KERNEL_PATH = L"" EFI_VENDOR_PATH "BOOT" EFI_SUFFIX ".EFI";
 CONST CHAR16* cp932_bin_path = L"" EFI_VENDOR_PATH "CP932.BIN";
 CONST CHAR16* cp932_fnt_path = L"" EFI_VENDOR_PATH "CP932.FNT";
+CONST CHAR16* cp932_subset_fnt_path = L"" EFI_VENDOR_PATH "CP932S.FNT";
+CONST CHAR16* stat_path = L"" EFI_VENDOR_PATH "STAT.TXT";
 CONST CHAR16* SHELL_PATH = L"\\EFI\\BOOT\\SHELL" EFI_SUFFIX ".EFI";
 
 CONST EFI_GUID EfiLoadedImageProtocolGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
@@ -39,9 +42,12 @@ CONST EFI_GUID efi_acpi_20_table_guid = EFI_ACPI_20_TABLE_GUID;
 int printf(const char*, ...);
 int snprintf(char*, size_t, const char*, ...);
 int puts(const char*);
+int vformat(int (*sink)(void*, const char*, size_t), void* context, const char* format, va_list args);
 void* malloc(size_t);
 void free(void*);
+void* memcpy(void *, const void *, size_t);
 void* memset(void *, int, size_t);
+int memcmp(const void *, const void *, size_t);
 
 typedef enum {
     menu_item_start_normally = 1,
@@ -64,6 +70,8 @@ EFI_HANDLE* image;
 
 EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* cout = NULL;
 EFI_GRAPHICS_OUTPUT_PROTOCOL* gop = NULL;
+EFI_GRAPHICS_OUTPUT_PROTOCOL* gop_mirrors[MAX_GOP_MIRRORS];
+int n_gop_mirrors = 0;
 int edid_x = 0, edid_y = 0;
 EFI_FILE_HANDLE sysdrv = NULL;
 
@@ -73,9 +81,7 @@ int n_entries_xsdt = 0;
 
 
 static inline int IsEqualGUID(CONST EFI_GUID* guid1, CONST EFI_GUID* guid2) {
-    uint64_t* p = (uint64_t*)guid1;
-    uint64_t* q = (uint64_t*)guid2;
-    return (p[0] == q[0]) && (p[1] == q[1]);
+    return !memcmp(guid1, guid2, sizeof(EFI_GUID));
 }
 
 static void* efi_find_config_table(EFI_SYSTEM_TABLE *st, CONST EFI_GUID* guid) {
@@ -89,9 +95,7 @@ static void* efi_find_config_table(EFI_SYSTEM_TABLE *st, CONST EFI_GUID* guid) {
 }
 
 static int is_equal_signature(const void* p1, const void* p2) {
-    const uint32_t* _p1 = (const uint32_t*)p1;
-    const uint32_t* _p2 = (const uint32_t*)p2;
-    return (*_p1 == *_p2);
+    return !memcmp(p1, p2, 4);
 }
 
 void* acpi_find_table(const char* signature) {
@@ -139,60 +143,6 @@ const char* get_string(rsrc id) {
 }
 
 
-int putchar(unsigned char c) {
-    static uint8_t state[2] = {0};
-    uint32_t ch = INVALID_UNICHAR;
-
-    if(c < 0x80) { // ASCII
-        if(state[0] == 0){
-            ch = c;
-        } else {
-            state[0] = 0;
-        }
-    } else if(c < 0xC0) { // Trail Bytes
-        if(state[0] < 0xE0) { // 2bytes (Cx 8x .. Dx Bx)
-            ch = ((state[0]&0x1F)<<6)|(c&0x3F);
-            state[0] = 0;
-        } else if (state[0] < 0xF0) { // 3bytes (Ex 8x 8x)
-            if(state[1] == 0){
-                state[1] = c;
-                ch = ZWNBSP;
-            } else {
-                ch = ((state[0]&0x0F)<<12)|((state[1]&0x3F)<<6)|(c&0x3F);
-                state[0] = 0;
-            }
-        }
-    } else if(c >= 0xC2 && c <= 0xEF) { // Leading Byte
-        state[0] = c;
-        state[1] = 0;
-        ch = ZWNBSP;
-    } else { // invalid sequence
-        state[0] = 0;
-    }
-
-    if(ch == INVALID_UNICHAR) ch ='?';
-
-    switch(ch) {
-        default:
-        {
-            CHAR16 box[] = { ch, 0 };
-            EFI_STATUS status = cout->OutputString(cout, box);
-            return status ? 0 : 1;
-        }
-
-        case '\n':
-        {
-            static CONST CHAR16* crlf = L"\r\n";
-            EFI_STATUS status = cout->OutputString(cout, crlf);
-            return status ? 0 : 1;
-        }
-
-        case ZWNBSP:
-            return 0;
-    }
-
-}
-
 void* malloc(size_t n) {
     void* result = 0;
     EFI_STATUS status = gST->BootServices->AllocatePool(EfiLoaderData, n, &result);
@@ -226,6 +176,10 @@ int validate_edid(size_t size, void* _edid) {
     return 1;
 }
 
+static UINTN gop_area(EFI_GRAPHICS_OUTPUT_PROTOCOL* display) {
+    return display->Mode->Info->HorizontalResolution * display->Mode->Info->VerticalResolution;
+}
+
 EFI_STATUS init_gop(EFI_HANDLE* image) {
     EFI_STATUS status;
 
@@ -234,12 +188,40 @@ EFI_STATUS init_gop(EFI_HANDLE* image) {
     status = gBS->LocateHandleBuffer(ByProtocol, &EfiGraphicsOutputProtocolGuid, NULL, &handleCount, &handleBuffer);
     if(EFI_ERROR(status)) {
         return EFI_NOT_FOUND;
-    } else {
-        gBS->OpenProtocol(handleBuffer[0], &EfiGraphicsOutputProtocolGuid, (void*)&gop, image, NULL, EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+    }
+
+    //  Every display has a device path, the console splitter has none and draws on all of them by itself.
+    //  The smallest display lays out the text, the others show a copy of it
+    for(UINTN i=0; i<handleCount; i++) {
+        EFI_DEVICE_PATH_PROTOCOL* dp;
+        EFI_GRAPHICS_OUTPUT_PROTOCOL* display;
+        status = gBS->HandleProtocol(handleBuffer[i], &EfiDevicePathProtocolGuid, (void**)&dp);
+        if(EFI_ERROR(status)) continue;
+        status = gBS->OpenProtocol(handleBuffer[i], &EfiGraphicsOutputProtocolGuid, (void**)&display, image, NULL, EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
+        if(EFI_ERROR(status)) continue;
+
+        if(!gop) {
+            gop = display;
+        } else if(n_gop_mirrors < MAX_GOP_MIRRORS) {
+            if(display->Mode->FrameBufferBase && display->Mode->FrameBufferBase == gop->Mode->FrameBufferBase) continue;
+            if(gop_area(display) < gop_area(gop)) {
+                gop_mirrors[n_gop_mirrors++] = gop;
+                gop = display;
+            } else {
+                gop_mirrors[n_gop_mirrors++] = display;
+            }
+        }
+    }
+    if(!gop) {
+        status = gBS->OpenProtocol(handleBuffer[0], &EfiGraphicsOutputProtocolGuid, (void**)&gop, image, NULL, EFI_OPEN_PROTOCOL_BY_HANDLE_PROTOCOL);
         if(EFI_ERROR(status)) {
-            return EFI_NOT_FOUND;
+            gop = NULL;
         }
     }
+    gBS->FreePool(handleBuffer);
+    if(!gop) {
+        return EFI_NOT_FOUND;
+    }
 
     EFI_EDID_ACTIVE_PROTOCOL* edid1;
     status = gBS->LocateProtocol(&EfiEdidActiveProtocolGuid, NULL, (void**)&edid1);
@@ -320,8 +302,6 @@ void change_resolution_menu() {
         ) {
             white = FALSE;
         }
-        if (info->PixelFormat != GOP_STANDARD_RGB)
-            white = FALSE;
         if (white){
             if(mode->Mode == i) {
                 items->selected_index = items->item_count;
@@ -346,6 +326,145 @@ void change_resolution_menu() {
 }
 
 
+typedef struct {
+    EFI_FILE_HANDLE handle;
+    EFI_STATUS status;
+} efi_file_sink_context;
+
+static int efi_file_sink(void* context, const char* s, size_t n) {
+    efi_file_sink_context* file = context;
+    UINTN write_count = n;
+    file->status = file->handle->Write(file->handle, &write_count, (void*)s);
+    if (!EFI_ERROR(file->status) && write_count != n) file->status = EFI_VOLUME_FULL;
+    return EFI_ERROR(file->status);
+}
+
+//  Replace the file with formatted text, written out as it is formatted
+EFI_STATUS efi_put_file_printf(IN EFI_FILE_HANDLE fs, IN CONST CHAR16* path, IN CONST char* format, ...) {
+    EFI_STATUS status;
+    EFI_FILE_HANDLE handle = NULL;
+
+    //  Opening with EFI_FILE_MODE_CREATE does not truncate an existing file
+    status = fs->Open(fs, &handle, path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    if(!EFI_ERROR(status)) {
+        handle->Delete(handle);
+    }
+
+    status = fs->Open(fs, &handle, path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+    if(EFI_ERROR(status)) return status;
+
+    efi_file_sink_context file = { handle, EFI_SUCCESS };
+    va_list list;
+    va_start(list, format);
+    vformat(efi_file_sink, &file, format, list);
+    va_end(list);
+    EFI_STATUS close_status = handle->Close(handle);
+    if(EFI_ERROR(file.status)) return file.status;
+
+    return close_status;
+}
+
+//  Messages of the boot kept in memory, saved along with System Information
+typedef struct {
+    char* buffer;
+    size_t size, used;
+} log_buffer;
+
+static log_buffer boot_log;
+
+static int log_sink(void* context, const char* s, size_t n) {
+    log_buffer* log = context;
+    if (log->used + n >= log->size) {
+        size_t size = log->size ? log->size : 0x400;
+        while (log->used + n >= size) size *= 2;
+        char* buffer = malloc(size);
+        if (!buffer) return 1;
+        if (log->buffer) {
+            memcpy(buffer, log->buffer, log->used);
+            free(log->buffer);
+        }
+        log->buffer = buffer;
+        log->size = size;
+    }
+    memcpy(log->buffer + log->used, s, n);
+    log->used += n;
+    log->buffer[log->used] = '\0';
+    return 0;
+}
+
+int log_printf(const char* format, ...) {
+    va_list list;
+    va_start(list, format);
+    int retval = vformat(log_sink, &boot_log, format, list);
+    va_end(list);
+    return retval;
+}
+
+//  Ticks of cpu_ticks() in microseconds, without 64-bit division
+static uint32_t ticks_to_us(uint64_t ticks, uint32_t ticks_per_us) {
+    while (ticks > UINT32_MAX) {
+        ticks >>= 1;
+        ticks_per_us >>= 1;
+    }
+    return ticks_per_us ? (uint32_t)ticks / ticks_per_us : UINT32_MAX;
+}
+
+//  Block operations measured against the ones of the firmware, only when asked for
+#define MEM_BENCH_SIZE  0x100000
+#define MEM_BENCH_BYTES 0x1000000
+
+typedef enum {
+    mem_bench_memcpy,
+    mem_bench_copymem,
+    mem_bench_memset,
+    mem_bench_setmem,
+} mem_bench_op;
+
+//  Bytes per microsecond, that is MB/s, moving MEM_BENCH_BYTES in blocks of size
+static uint32_t mem_bandwidth(mem_bench_op op, uint8_t* dst, uint8_t* src, size_t size, uint32_t ticks_per_us) {
+    uint64_t t0 = cpu_ticks();
+    for (size_t done = 0; done < MEM_BENCH_BYTES; done += size) {
+        switch (op) {
+        case mem_bench_memcpy:
+            memcpy(dst, src, size);
+            break;
+        case mem_bench_copymem:
+            gBS->CopyMem(dst, src, size);
+            break;
+        case mem_bench_memset:
+            memset(dst, (int)(done >> 12), size);
+            break;
+        case mem_bench_setmem:
+            gBS->SetMem(dst, size, (UINT8)(done >> 12));
+            break;
+        }
+    }
+    uint32_t us = ticks_to_us(cpu_ticks() - t0, ticks_per_us);
+    return MEM_BENCH_BYTES / (us ? us : 1);
+}
+
+//  Lines of memcpy/memset against CopyMem/SetMem at a few block sizes
+static int mem_bench(char* buffer, size_t size, uint32_t ticks_per_us) {
+    static const size_t block_sizes[] = { 0x1000, 0x10000, MEM_BENCH_SIZE };
+
+    //  Pool memory, so the compiler can't tell the copies are never read
+    uint8_t *bench_buffer = NULL;
+    if (!ticks_per_us || EFI_ERROR(gBS->AllocatePool(EfiLoaderData, 2 * MEM_BENCH_SIZE, (void**)&bench_buffer))) {
+        return snprintf(buffer, size, "  Memory: can't measure\n");
+    }
+    uint8_t *dst = bench_buffer, *src = bench_buffer + MEM_BENCH_SIZE;
+    int len = 0;
+    for (int i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        size_t block = block_sizes[i];
+        len += snprintf(buffer + len, size - len, "  Memory %4u KB: memcpy %u, CopyMem %u, memset %u, SetMem %u MB/s\n",
+         (uint32_t)(block >> 10),
+         mem_bandwidth(mem_bench_memcpy, dst, src, block, ticks_per_us), mem_bandwidth(mem_bench_copymem, dst, src, block, ticks_per_us),
+         mem_bandwidth(mem_bench_memset, dst, src, block, ticks_per_us), mem_bandwidth(mem_bench_setmem, dst, src, block, ticks_per_us));
+    }
+    gBS->FreePool(bench_buffer);
+    return len;
+}
+
 void system_info() {
 
     static char caption[1024];
@@ -361,20 +480,90 @@ void system_info() {
     const char *arch = "arm";
 #endif
 
-    snprintf(caption, 1023, "UEFI ver %d.%d (%S %08x)\n  Arch: %s\n",
+    int len = snprintf(caption, 1023, "UEFI ver %d.%d (%S %08x)\n  Arch: %s\n",
      (int)(uver >> 16), (int)(uver & 0xFFFF), gST->FirmwareVendor, gST->FirmwareRevision, arch);
 
+    ATOP_glyph_cache_stat cache_stat;
+    if (!EFI_ERROR(ATOP_get_glyph_cache_stat(cout, &cache_stat))) {
+        len += snprintf(caption + len, 1023 - len, "  Glyph cache: %u/%u entries, %u hits, %u misses\n",
+         cache_stat.used, cache_stat.size, cache_stat.hits, cache_stat.misses);
+    }
+
+    cp932_tbl_stat tbl_stat;
+    cp932_get_tbl_stat(&tbl_stat);
+    if (tbl_stat.pages) {
+        len += snprintf(caption + len, 1023 - len, "  CP932 table: %u bytes in %u pages (flat: %u bytes)\n",
+         tbl_stat.paged_size, tbl_stat.pages, tbl_stat.flat_size);
+    }
+
+    cp932_font_stat font_stat;
+    cp932_get_font_stat(&font_stat);
+    if (font_stat.pages) {
+        len += snprintf(caption + len, 1023 - len, "  CP932 font: %u glyphs, %u/%u pages loaded, %u bytes resident\n",
+         font_stat.glyphs, font_stat.pages_loaded, font_stat.pages, font_stat.resident);
+    } else if (font_stat.glyphs) {
+        len += snprintf(caption + len, 1023 - len, "  CP932 font: %u glyphs, %u bytes resident\n",
+         font_stat.glyphs, font_stat.resident);
+    }
+
+    uint64_t t0 = cpu_ticks();
+    gBS->Stall(10000);
+    uint32_t ticks_per_us = (uint32_t)(cpu_ticks() - t0) / 10000;
+
+    lz_stat packed_stat;
+    lz_get_stat(&packed_stat);
+    if (packed_stat.files) {
+        len += snprintf(caption + len, 1023 - len, "  Packed files: %u, %u bytes read for %u bytes",
+         packed_stat.files, packed_stat.packed, packed_stat.unpacked);
+        if (ticks_per_us) {
+            len += snprintf(caption + len, 1023 - len, ", %u us decoding", ticks_to_us(packed_stat.ticks, ticks_per_us));
+        }
+        len += snprintf(caption + len, 1023 - len, "\n");
+    }
+
+    //  Counters of the console, to tell rendering from the time in the firmware
+    ATOP_render_stat render_stat;
+    if (!EFI_ERROR(ATOP_get_render_stat(cout, &render_stat))) {
+        gop_pixel_stat pixel_stat;
+        gop_get_pixel_stat(&pixel_stat);
+        len += snprintf(caption + len, 1023 - len, "  Console: %u strings, %u glyphs (%u wide), %u scrolls (%u moves)\n",
+         render_stat.outputs, render_stat.glyphs, render_stat.wide_glyphs, render_stat.scrolls, render_stat.scroll_moves);
+        len += snprintf(caption + len, 1023 - len, "  Video: %lu pixels, %u writes, Blt %u/%u/%u/%u (fill/read/write/move)\n",
+         pixel_stat.pixels, pixel_stat.writes, pixel_stat.blts[EfiBltVideoFill], pixel_stat.blts[EfiBltVideoToBltBuffer],
+         pixel_stat.blts[EfiBltBufferToVideo], pixel_stat.blts[EfiBltVideoToVideo]);
+
+        if (ticks_per_us) {
+            len += snprintf(caption + len, 1023 - len, "  Time: %u us in OutputString, %u us writing the screen\n",
+             ticks_to_us(render_stat.output_ticks, ticks_per_us), ticks_to_us(pixel_stat.ticks, ticks_per_us));
+        }
+    }
+
+    int counters_len = len, info_len = len;
     menu_buffer* items = init_menu();
     menu_add(items, get_string(rsrc_return_to_previous), 0);
+    menu_add(items, get_string(rsrc_save_counters), 1);
+    menu_add(items, get_string(rsrc_memory_bandwidth), 2);
     menu_add(items, NULL, 0);
 
     uintptr_t menuresult;
     do {
         menuresult = show_menu(items, get_string(rsrc_system_info), caption);
 
-        if(menuresult) {
-            gop->SetMode(gop, menuresult-1);
-            cout->Reset(cout, TRUE);
+        if(menuresult == 2) {
+            //  Kept with the counters, so a save after it has the results too
+            len = counters_len;
+            len += mem_bench(caption + len, 1023 - len, ticks_per_us);
+            info_len = len;
+        } else if(menuresult) {
+            EFI_STATUS status = efi_put_file_printf(sysdrv, stat_path, "%.*s\nBoot log:\n%s",
+             info_len, caption, boot_log.buffer ? boot_log.buffer : "");
+            len = info_len;
+            if (EFI_ERROR(status)) {
+                len += snprintf(caption + len, 1023 - len, "  Can't write %S (%zx)\n", stat_path, status);
+            } else {
+                len += snprintf(caption + len, 1023 - len, "  Saved to %S\n", stat_path);
+            }
+            items->selected_index = 0;
         }
     }while(menuresult);
 
@@ -546,10 +735,15 @@ EFI_STATUS efi_get_file_content(IN EFI_FILE_HANDLE fs, IN CONST CHAR16* path, OU
     status = handle->Read(handle, &read_count, buff);
     if(EFI_ERROR(status)) goto error;
     status = handle->Close(handle);
+    handle = NULL;
     if(EFI_ERROR(status)) goto error;
 
-    result->base = buff;
-    result->size = read_count;
+    //  Packed files are returned unpacked
+    base_and_size content = { buff, read_count };
+    status = lz_unpack(&content);
+    if(EFI_ERROR(status)) goto error;
+
+    *result = content;
 
     return EFI_SUCCESS;
 
@@ -607,9 +801,9 @@ void efi_blt_bmp(uint8_t *bmp, int offset_x, int offset_y) {
     int bmp_delta = (bmp_bpp8 * bmp_w + 3) & 0xFFFFFFFC;
     const uint8_t *msdib = bmp + *((uint32_t *)(bmp + 10));
 
-    UINTN blt_delta = bmp_w * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
-    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt_buffer = malloc(blt_delta * bmp_h);
-    uint32_t *q = (uint32_t *)blt_buffer;
+    uint32_t *blt_buffer = malloc(sizeof(uint32_t) * bmp_w * bmp_h);
+    if (!blt_buffer) return;
+    uint32_t *q = blt_buffer;
 
     switch (bmp_bpp) {
         case 24:
@@ -624,7 +818,14 @@ void efi_blt_bmp(uint8_t *bmp, int offset_x, int offset_y) {
             break;
     }
 
-    gop->Blt(gop, blt_buffer, EfiBltBufferToVideo, 0, 0, offset_x, offset_y, bmp_w, bmp_h, blt_delta);
+    gop_pixel_format pf;
+    gop_pixel_format_init(&pf, gop);
+    gop_convert_pixels(&pf, blt_buffer, blt_buffer, bmp_w * bmp_h);
+
+    //  Above the TPL of the cursor timer of the console, which writes to the same screen
+    EFI_TPL tpl = gBS->RaiseTPL(TPL_NOTIFY);
+    gop_write_pixels(&pf, blt_buffer, bmp_w, offset_x, offset_y, bmp_w, bmp_h);
+    gBS->RestoreTPL(tpl);
 
     free(blt_buffer);
 }
@@ -669,30 +870,64 @@ EFI_STATUS EFIAPI efi_main(IN EFI_HANDLE _image, IN EFI_SYSTEM_TABLE *st) {
 
     //	Init Screen
     init_gop(image);
+    if(gop) {
+        log_printf("Display: %ux%u, EDID %dx%d, %d mirrors\n",
+         gop->Mode->Info->HorizontalResolution, gop->Mode->Info->VerticalResolution, edid_x, edid_y, n_gop_mirrors);
+    }
     efi_console_control(!gop);
     if(gop) {
 
+        //	CP932.BIN overrides the built-in table if present
         base_and_size cp932_bin_ptr;
         status = efi_get_file_content(sysdrv, cp932_bin_path, &cp932_bin_ptr);
-        if(EFI_ERROR(status)) {
-            printf("ERROR: can't read %S (%zx)\n", cp932_bin_path, status);
-            goto cp932_exit;
+        if(!EFI_ERROR(status)) {
+            cp932_tbl_init(cp932_bin_ptr);
         }
-        cp932_tbl_init(cp932_bin_ptr);
 
+        //	The full font is read a page at a time when its glyphs are drawn,
+        //	or read whole if it is packed. The subset made by the build has
+        //	just the glyphs of the UI strings, for media without the full font
         base_and_size cp932_fnt_ptr;
-        status = efi_get_file_content(sysdrv, cp932_fnt_path, &cp932_fnt_ptr);
+        EFI_FILE_HANDLE handle;
+        status = sysdrv->Open(sysdrv, &handle, cp932_fnt_path, EFI_FILE_MODE_READ, 0);
+        if(!EFI_ERROR(status)) {
+            status = cp932_font_open(handle);
+            if(EFI_ERROR(status)) {
+                handle->Close(handle);
+            }
+        }
+        if(EFI_ERROR(status)) {
+            status = efi_get_file_content(sysdrv, cp932_fnt_path, &cp932_fnt_ptr);
+            if(!EFI_ERROR(status)) {
+                status = cp932_font_init(cp932_fnt_ptr);
+                if(EFI_ERROR(status)) {
+                    free(cp932_fnt_ptr.base);
+                }
+            }
+        }
+        if(EFI_ERROR(status)) {
+            EFI_STATUS subset_status = efi_get_file_content(sysdrv, cp932_subset_fnt_path, &cp932_fnt_ptr);
+            if(!EFI_ERROR(subset_status)) {
+                status = cp932_font_init(cp932_fnt_ptr);
+                if(EFI_ERROR(status)) {
+                    free(cp932_fnt_ptr.base);
+                }
+            }
+        }
         if(EFI_ERROR(status)) {
             printf("ERROR: can't read %S (%zx)\n", cp932_fnt_path, status);
+            log_printf("Can't read %S (%zx)\n", cp932_fnt_path, status);
             goto cp932_exit;
         }
-        cp932_font_init(cp932_fnt_ptr);
 
         rsrc_ja_enabled = TRUE;
 
 cp932_exit:
 
         ATOP_init(gop, &cout);
+        for(int i=0; i<n_gop_mirrors; i++) {
+            ATOP_add_mirror(cout, gop_mirrors[i]);
+        }
     }
 
 
@@ -40,6 +40,41 @@ typedef struct {
 	uintptr_t item_id;
 } menuitem;
 
+typedef struct {
+	uint32_t size, used, hits, misses;
+} ATOP_glyph_cache_stat;
+
+typedef struct {
+	uint32_t outputs, glyphs, wide_glyphs, scrolls, scroll_moves;
+	uint64_t output_ticks;
+} ATOP_render_stat;
+
+typedef struct {
+	EFI_GRAPHICS_OUTPUT_PROTOCOL* gop;
+	uint32_t* frame_buffer;
+	EFI_GRAPHICS_PIXEL_FORMAT format;
+	intptr_t width, height, ppl;
+	uint8_t shr[3], shl[3];
+} gop_pixel_format;
+
+typedef struct {
+	uint32_t blts[EfiGraphicsOutputBltOperationMax], writes;
+	uint64_t pixels, ticks;
+} gop_pixel_stat;
+
+typedef struct {
+	uint32_t pages, paged_size, flat_size;
+} cp932_tbl_stat;
+
+typedef struct {
+	uint32_t glyphs, pages, pages_loaded, resident;
+} cp932_font_stat;
+
+typedef struct {
+	uint32_t files, packed, unpacked;
+	uint64_t ticks;
+} lz_stat;
+
 typedef struct {
 	menuitem* items;
 	char* string_pool;
@@ -47,8 +82,37 @@ typedef struct {
 } menu_buffer;
 
 EFI_STATUS cp932_tbl_init(base_and_size);
+uint32_t cp932_from_unicode(uint32_t code);
+void cp932_get_tbl_stat(cp932_tbl_stat* result);
 EFI_STATUS cp932_font_init(base_and_size);
+EFI_STATUS cp932_font_open(EFI_FILE_HANDLE file);
+intptr_t cp932_font_find(uint32_t code);
+const uint8_t* cp932_font_glyph(intptr_t index);
+void cp932_font_close();
+void cp932_get_font_stat(cp932_font_stat* result);
 EFIAPI EFI_STATUS ATOP_init(IN EFI_GRAPHICS_OUTPUT_PROTOCOL* gop, OUT EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL** result);
+EFI_STATUS ATOP_get_glyph_cache_stat(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text, OUT ATOP_glyph_cache_stat* result);
+EFI_STATUS ATOP_get_render_stat(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text, OUT ATOP_render_stat* result);
+EFI_STATUS ATOP_scroll_view(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text, IN intptr_t lines);
+EFI_STATUS ATOP_add_mirror(IN EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* text, IN EFI_GRAPHICS_OUTPUT_PROTOCOL* gop);
+
+intptr_t lz_decode(uint8_t* dst, size_t dst_size, const uint8_t* src, size_t src_size);
+int lz_is_packed(const base_and_size* data);
+EFI_STATUS lz_unpack(base_and_size* data);
+void lz_get_stat(lz_stat* result);
+
+void gop_pixel_format_init(gop_pixel_format* pf, EFI_GRAPHICS_OUTPUT_PROTOCOL* gop);
+void gop_convert_pixels(const gop_pixel_format* pf, uint32_t* dst, const uint32_t* src, intptr_t n);
+uint32_t gop_convert_color(const gop_pixel_format* pf, uint32_t rgb);
+int gop_pixel_format_mirror(gop_pixel_format* pf, const gop_pixel_format* src);
+int gop_pixel_blendable(const gop_pixel_format* pf);
+void gop_write_pixels(const gop_pixel_format* pf, const uint32_t* src, intptr_t delta, int x, int y, int w, int h);
+void gop_fill_pixels(const gop_pixel_format* pf, uint32_t color, int x, int y, int w, int h);
+void gop_get_pixel_stat(gop_pixel_stat* result);
+uint64_t cpu_ticks();
+
+void glyph_expand(uint32_t* dst, const uint8_t* pattern, intptr_t w, uint32_t fgcolor, uint32_t bgcolor);
+void glyph_blend(uint32_t* dst, const uint8_t* coverage, intptr_t w, uint32_t fgcolor, uint32_t bgcolor);
 
 EFI_INPUT_KEY efi_wait_any_key(BOOLEAN, int);
 menu_buffer* init_menu();
@@ -0,0 +1,196 @@
+// Native pixel formats of the GOP frame buffer
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include "osldr.h"
+
+void *memcpy(void *, const void *, size_t);
+
+
+static gop_pixel_stat pixel_total;
+
+//  Free running counter of the CPU, 0 where there is none to read
+uint64_t cpu_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return 0;
+#endif
+}
+
+//  Position and width of a channel in a PixelBitMask pixel, scaled from 8 bits
+static void pixel_channel(uint32_t mask, uint8_t *shr, uint8_t *shl) {
+    int lsb = 0, width = 0;
+    if (mask) {
+        while (!(mask & (1u << lsb))) lsb++;
+        while (lsb + width < 32 && (mask & (1u << (lsb + width)))) width++;
+    }
+    if (width < 8) {
+        *shr = 8 - width;
+        *shl = lsb;
+    } else {
+        *shr = 0;
+        *shl = lsb + width - 8;
+    }
+}
+
+void gop_pixel_format_init(gop_pixel_format* pf, EFI_GRAPHICS_OUTPUT_PROTOCOL* gop) {
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = gop->Mode->Info;
+    pf->gop = gop;
+    pf->format = info->PixelFormat;
+    pf->width = info->HorizontalResolution;
+    pf->height = info->VerticalResolution;
+    pf->ppl = info->PixelsPerScanLine;
+    pf->frame_buffer = (uint32_t *)(uintptr_t)gop->Mode->FrameBufferBase;
+    if (pf->format == PixelBltOnly) pf->frame_buffer = NULL;
+
+    if (pf->format == PixelBitMask) {
+        pixel_channel(info->PixelInformation.RedMask, &pf->shr[0], &pf->shl[0]);
+        pixel_channel(info->PixelInformation.GreenMask, &pf->shr[1], &pf->shl[1]);
+        pixel_channel(info->PixelInformation.BlueMask, &pf->shr[2], &pf->shl[2]);
+    }
+}
+
+
+//  Converters from 0x00RRGGBB, one loop per pixel format
+#define DEFINE_PIXEL_CONVERTER(name, expr) \
+static void name(const gop_pixel_format* pf, uint32_t* dst, const uint32_t* src, intptr_t n) { \
+    for (intptr_t i = 0; i < n; i++) { \
+        uint32_t c = src[i]; \
+        dst[i] = (expr); \
+    } \
+}
+
+DEFINE_PIXEL_CONVERTER(pixel_to_bgr, c & 0x00FFFFFF)
+DEFINE_PIXEL_CONVERTER(pixel_to_rgb, ((c >> 16) & 0xFF) | (c & 0xFF00) | ((c & 0xFF) << 16))
+DEFINE_PIXEL_CONVERTER(pixel_to_bitmask,
+    ((((c >> 16) & 0xFF) >> pf->shr[0]) << pf->shl[0]) |
+    ((((c >> 8) & 0xFF) >> pf->shr[1]) << pf->shl[1]) |
+    (((c & 0xFF) >> pf->shr[2]) << pf->shl[2]))
+
+void gop_convert_pixels(const gop_pixel_format* pf, uint32_t* dst, const uint32_t* src, intptr_t n) {
+    switch (pf->format) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+        pixel_to_rgb(pf, dst, src, n);
+        break;
+    case PixelBitMask:
+        pixel_to_bitmask(pf, dst, src, n);
+        break;
+    default:
+        //  Blt takes the same layout as PixelBlueGreenRedReserved8BitPerColor
+        pixel_to_bgr(pf, dst, src, n);
+        break;
+    }
+}
+
+uint32_t gop_convert_color(const gop_pixel_format* pf, uint32_t rgb) {
+    uint32_t result;
+    gop_convert_pixels(pf, &result, &rgb, 1);
+    return result;
+}
+
+//  Layout of the pixels in memory, Blt buffers being BGR
+static EFI_GRAPHICS_PIXEL_FORMAT pixel_layout(const gop_pixel_format* pf) {
+    return (pf->format == PixelBltOnly) ? PixelBlueGreenRedReserved8BitPerColor : pf->format;
+}
+
+//  Let pf take the native pixels of src as they are, through Blt if its own layout differs.
+//  Returns 0 if neither can
+int gop_pixel_format_mirror(gop_pixel_format* pf, const gop_pixel_format* src) {
+    EFI_GRAPHICS_PIXEL_FORMAT layout = pixel_layout(pf), src_layout = pixel_layout(src);
+    if (layout == src_layout) {
+        if (layout != PixelBitMask) return 1;
+        int same = 1;
+        for (int i = 0; i < 3; i++) {
+            if (pf->shr[i] != src->shr[i] || pf->shl[i] != src->shl[i]) same = 0;
+        }
+        if (same) return 1;
+    }
+    if (src_layout == PixelBlueGreenRedReserved8BitPerColor) {
+        pf->frame_buffer = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+//  Whether each channel is one byte of the pixel, so pixels can be blended byte by byte
+int gop_pixel_blendable(const gop_pixel_format* pf) {
+    if (pf->format != PixelBitMask) return 1;
+    for (int i = 0; i < 3; i++) {
+        if (pf->shr[i] || (pf->shl[i] & 7)) return 0;
+    }
+    return 1;
+}
+
+
+//  Copy a block of native pixels to the screen, w x h at (x, y), delta pixels per scan line
+void gop_write_pixels(const gop_pixel_format* pf, const uint32_t* src, intptr_t delta, int x, int y, int w, int h) {
+    if (x < 0) {
+        src -= x;
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        src -= y * delta;
+        h += y;
+        y = 0;
+    }
+    if (w > pf->width - x) w = pf->width - x;
+    if (h > pf->height - y) h = pf->height - y;
+    if (w <= 0 || h <= 0) return;
+
+    uint64_t t0 = cpu_ticks();
+    if (pf->frame_buffer) {
+        uint32_t *p = pf->frame_buffer + y * pf->ppl + x;
+        for (int i = 0; i < h; i++, p += pf->ppl, src += delta) {
+            memcpy(p, src, sizeof(uint32_t) * w);
+        }
+        pixel_total.writes++;
+    } else {
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = pf->gop;
+        gop->Blt(gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)src, EfiBltBufferToVideo, 0, 0, x, y, w, h, sizeof(uint32_t) * delta);
+        pixel_total.blts[EfiBltBufferToVideo]++;
+    }
+    pixel_total.pixels += w * h;
+    pixel_total.ticks += cpu_ticks() - t0;
+}
+
+//  Fill w x h at (x, y) with a native pixel
+void gop_fill_pixels(const gop_pixel_format* pf, uint32_t color, int x, int y, int w, int h) {
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (w > pf->width - x) w = pf->width - x;
+    if (h > pf->height - y) h = pf->height - y;
+    if (w <= 0 || h <= 0) return;
+
+    uint64_t t0 = cpu_ticks();
+    if (pf->frame_buffer) {
+        uint32_t *p = pf->frame_buffer + y * pf->ppl + x;
+        for (int i = 0; i < h; i++, p += pf->ppl) {
+            for (int j = 0; j < w; j++) {
+                p[j] = color;
+            }
+        }
+        pixel_total.writes++;
+    } else {
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = pf->gop;
+        gop->Blt(gop, (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)&color, EfiBltVideoFill, 0, 0, x, y, w, h, 0);
+        pixel_total.blts[EfiBltVideoFill]++;
+    }
+    pixel_total.pixels += w * h;
+    pixel_total.ticks += cpu_ticks() - t0;
+}
+
+//  Writes to the screen so far, and the ticks spent in them
+void gop_get_pixel_stat(gop_pixel_stat* result) {
+    *result = pixel_total;
+}
@@ -0,0 +1,435 @@
+// Host micro benchmarks for MEG-OS Loader
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "efi.h"
+#include "osldr.h"
+#include "rsrc.h"
+#include "megh0816.h"
+
+//  Only the cursor of ATOP uses the boot services, which the benchmarks leave alone
+EFI_BOOT_SERVICES* gBS;
+
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile intptr_t sink;
+
+
+//  FONTX2 file with the lead and trail byte ranges of CP932, filled with noise
+static base_and_size make_cp932_font() {
+    static const uint8_t leads[][2] = { { 0x81, 0x84 }, { 0x88, 0x9F }, { 0xE0, 0xEA } };
+    int n_leads = 0;
+    for (int i = 0; i < 3; i++) n_leads += leads[i][1] - leads[i][0] + 1;
+    int tbl_cnt = n_leads * 2;
+    size_t n_glyphs = n_leads * ((0x7E - 0x40 + 1) + (0xFC - 0x80 + 1));
+    size_t size = 0x12 + tbl_cnt * 4 + n_glyphs * 32;
+
+    uint8_t *font = calloc(1, size);
+    memcpy(font, "FONTX2BENCHMRK", 14);
+    font[0x0E] = 16;
+    font[0x0F] = 16;
+    font[0x10] = 1;
+    font[0x11] = tbl_cnt;
+    uint8_t *p = font + 0x12;
+    for (int i = 0; i < 3; i++) {
+        for (int lead = leads[i][0]; lead <= leads[i][1]; lead++) {
+            const uint8_t ranges[] = { 0x40, 0x7E, 0x80, 0xFC };
+            for (int j = 0; j < 4; j++) {
+                *p++ = ranges[j];
+                *p++ = lead;
+            }
+        }
+    }
+    srand(1);
+    for (; p < font + size; p++) *p = rand();
+
+    base_and_size result = { font, size };
+    return result;
+}
+
+static int load_file(const char *path, base_and_size *result) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    result->base = malloc(size);
+    result->size = fread(result->base, 1, size, fp);
+    fclose(fp);
+    return !EFI_ERROR(lz_unpack(result));
+}
+
+
+//  EFI_FILE_PROTOCOL on a host file, counting what is read
+typedef struct {
+    EFI_FILE_PROTOCOL file;
+    FILE *fp;
+    size_t reads, bytes_read;
+} mock_file;
+
+//  The host file is shared by every open and closed by its owner
+static EFI_STATUS EFIAPI mock_close(EFI_FILE_PROTOCOL *This) {
+    free(This);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_read(EFI_FILE_PROTOCOL *This, UINTN *size, VOID *buffer) {
+    mock_file *file = (mock_file *)This;
+    *size = fread(buffer, 1, *size, file->fp);
+    file->reads++;
+    file->bytes_read += *size;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_get_position(EFI_FILE_PROTOCOL *This, UINT64 *position) {
+    *position = ftell(((mock_file *)This)->fp);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_set_position(EFI_FILE_PROTOCOL *This, UINT64 position) {
+    FILE *fp = ((mock_file *)This)->fp;
+    if (position == UINT64_MAX) {
+        fseek(fp, 0, SEEK_END);
+    } else {
+        fseek(fp, position, SEEK_SET);
+    }
+    return EFI_SUCCESS;
+}
+
+static mock_file *mock_open(FILE *fp) {
+    mock_file *file = calloc(1, sizeof(mock_file));
+    file->fp = fp;
+    file->file.Close = mock_close;
+    file->file.Read = mock_read;
+    file->file.GetPosition = mock_get_position;
+    file->file.SetPosition = mock_set_position;
+    return file;
+}
+
+//  Code points of the Japanese UI strings
+static int ui_codes(uint32_t *codes, int limit) {
+    int n = 0;
+    for (int i = 0; i < rsrc_max; i++) {
+        const uint8_t *p = (const uint8_t *)rsrc_ja[i];
+        if (!p) continue;
+        while (*p && n < limit) {
+            uint32_t c = *p++;
+            if (c >= 0xE0) {
+                c = ((c & 0x0F) << 12) | ((p[0] & 0x3F) << 6) | (p[1] & 0x3F);
+                p += 2;
+            } else if (c >= 0xC0) {
+                c = ((c & 0x1F) << 6) | (p[0] & 0x3F);
+                p++;
+            }
+            codes[n++] = c;
+        }
+    }
+    return n;
+}
+
+//  Time to the glyphs of the first menu, reading the whole font or only its pages
+static void bench_font_loading(FILE *fp) {
+    const int passes = 20;
+    static uint32_t codes[4096];
+    int n_codes = ui_codes(codes, 4096);
+
+    double t_eager = 0, t_lazy = 0;
+    size_t eager_read = 0, lazy_read = 0, lazy_reads = 0;
+    cp932_font_stat eager_stat, lazy_stat;
+    for (int k = 0; k < passes; k++) {
+        //  The same steps as efi_get_file_content
+        double t0 = now_ns();
+        mock_file *file = mock_open(fp);
+        UINT64 size;
+        file->file.SetPosition(&file->file, UINT64_MAX);
+        file->file.GetPosition(&file->file, &size);
+        file->file.SetPosition(&file->file, 0);
+        UINTN read_size = size;
+        base_and_size font = { malloc(size), size };
+        file->file.Read(&file->file, &read_size, font.base);
+        eager_read = file->bytes_read;
+        file->file.Close(&file->file);
+        cp932_font_init(font);
+        for (int i = 0; i < n_codes; i++) sink += (intptr_t)cp932_font_glyph(cp932_font_find(cp932_from_unicode(codes[i])));
+        double t1 = now_ns();
+        cp932_get_font_stat(&eager_stat);
+        cp932_font_close();
+        free(font.base);
+
+        //  Each variant starts without the font of the other, and releasing it isn't timed
+        double t2 = now_ns();
+        file = mock_open(fp);
+        cp932_font_open(&file->file);
+        for (int i = 0; i < n_codes; i++) sink += (intptr_t)cp932_font_glyph(cp932_font_find(cp932_from_unicode(codes[i])));
+        double t3 = now_ns();
+        lazy_read = file->bytes_read;
+        lazy_reads = file->reads;
+        cp932_get_font_stat(&lazy_stat);
+        cp932_font_close();
+
+        t_eager += t1 - t0;
+        t_lazy += t3 - t2;
+    }
+
+    printf("font loading: %d UI characters\n", n_codes);
+    printf("  eager  %8.1f us  %7zu bytes read            %7u bytes resident\n", t_eager / passes / 1000, eager_read, eager_stat.resident);
+    printf("  lazy   %8.1f us  %7zu bytes read in %3zu reads %7u bytes resident (%u/%u pages)\n", t_lazy / passes / 1000,
+        lazy_read, lazy_reads, lazy_stat.resident, lazy_stat.pages_loaded, lazy_stat.pages);
+}
+
+
+//  The range search ATOP used before the two level index
+static intptr_t find_linear(const uint8_t *font, uint32_t c) {
+    intptr_t index = 0;
+    for (int i = 0; i < font[0x11]; i++) {
+        const uint8_t *p = font + 0x12 + i * 4;
+        uint32_t begin = p[0] + p[1] * 256, end = p[2] + p[3] * 256;
+        if (c < begin) {
+            break;
+        } else if (c <= end) {
+            return index + (c - begin);
+        }
+        index += end - begin + 1;
+    }
+    return -1;
+}
+
+static void bench_widechar_lookup(const uint8_t *font) {
+    const int passes = 200;
+
+    //  Every lead and trail byte pair of CP932
+    static uint16_t codes[0x80 * 0xC0];
+    int n_codes = 0;
+    for (int lead = 0x81; lead <= 0xFC; lead++) {
+        for (int trail = 0x40; trail <= 0xFC; trail++) {
+            codes[n_codes++] = lead * 256 + trail;
+        }
+    }
+
+    int mismatch = 0, found = 0;
+    for (int i = 0; i < n_codes; i++) {
+        intptr_t a = find_linear(font, codes[i]), b = cp932_font_find(codes[i]);
+        if (a != b) mismatch++;
+        if (b >= 0) found++;
+    }
+
+    double t0 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (int i = 0; i < n_codes; i++) sink += find_linear(font, codes[i]);
+    }
+    double t1 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (int i = 0; i < n_codes; i++) sink += cp932_font_find(codes[i]);
+    }
+    double t2 = now_ns();
+
+    double n = (double)passes * n_codes;
+    printf("widechar lookup: %d codes, %d glyphs, %d ranges, %d mismatches\n", n_codes, found, font[0x11], mismatch);
+    printf("  range search  %8.2f ns/lookup\n", (t1 - t0) / n);
+    printf("  two level     %8.2f ns/lookup  (x%.1f)\n", (t2 - t1) / n, (t1 - t0) / (t2 - t1));
+}
+
+
+//  The flat table cp932_tbl_init built before the paged one
+static uint16_t *make_flat_table(const uint16_t *bin) {
+    uint16_t *table = calloc(0x10000, sizeof(uint16_t));
+    uint16_t cp932_code = 0x8140;
+    size_t length = *bin++;
+    for (int i = 0; i < length; i++) {
+        table[bin[i]] = cp932_code;
+        cp932_code++;
+        if ((cp932_code & 0xFF) == 0x7F) {
+            cp932_code++;
+        } else if ((cp932_code & 0xFF) >= 0xFD) {
+            cp932_code += (0x140 - 0xFD);
+            if (cp932_code == 0xA040) {
+                cp932_code = 0xE040;
+            }
+        }
+    }
+    return table;
+}
+
+static uint16_t *flat_table;
+
+__attribute__((noinline)) static uint32_t flat_from_unicode(uint32_t c) {
+    return (c < 0x10000) ? flat_table[c] : 0;
+}
+
+static void bench_uni2ansi(const char *label, const uint16_t *bin) {
+    const int passes = 200;
+    if (!flat_table) flat_table = make_flat_table(bin);
+
+    int mismatch = 0, mapped = 0;
+    for (uint32_t c = 0; c < 0x10000; c++) {
+        if (flat_from_unicode(c) != cp932_from_unicode(c)) mismatch++;
+        if (cp932_from_unicode(c)) mapped++;
+    }
+
+    double t0 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (uint32_t c = 0; c < 0x10000; c++) sink += flat_from_unicode(c);
+    }
+    double t1 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (uint32_t c = 0; c < 0x10000; c++) sink += cp932_from_unicode(c);
+    }
+    double t2 = now_ns();
+
+    cp932_tbl_stat stat;
+    cp932_get_tbl_stat(&stat);
+    double n = (double)passes * 0x10000;
+    printf("unicode to cp932 (%s): %d code points mapped, %d mismatches\n", label, mapped, mismatch);
+    printf("  flat   %7u bytes           %8.2f ns/lookup\n", stat.flat_size, (t1 - t0) / n);
+    printf("  paged  %7u bytes %3u pages %8.2f ns/lookup\n", stat.paged_size, stat.pages, (t2 - t1) / n);
+}
+
+
+//  Cells of 1bpp glyphs against cells of 8bpp coverage, and a plain copy of the same pixels
+static void bench_glyph_kernels() {
+    const int passes = 2000, cell_w = 8, cell_h = 16, cells = 96;
+    const uint8_t *patterns = &MEGH0816_fontdata[0][0];
+    static uint8_t coverage[96 * 16 * 8];
+    static uint32_t block[8 * 16], copy_src[8 * 16];
+
+    //  The ASCII font with a grey pixel on each side of a stroke, like anti-aliased text
+    for (int i = 0; i < cells * cell_h; i++) {
+        for (int x = 0; x < cell_w; x++) {
+            int on = patterns[i] & (0x80 >> x);
+            int edge = (x > 0 && (patterns[i] & (0x80 >> (x - 1)))) || (x < cell_w - 1 && (patterns[i] & (0x40 >> x)));
+            coverage[i * cell_w + x] = on ? 255 : edge ? 96 : 0;
+        }
+    }
+
+    double t0 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (int c = 0; c < cells; c++) {
+            for (int y = 0; y < cell_h; y++) glyph_expand(block + y * cell_w, patterns + c * cell_h + y, cell_w, 0xAAAAAA, 0x0000AA + k);
+            sink += block[c & 127];
+        }
+    }
+    double t1 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (int c = 0; c < cells; c++) {
+            for (int y = 0; y < cell_h; y++) glyph_blend(block + y * cell_w, coverage + (c * cell_h + y) * cell_w, cell_w, 0xAAAAAA, 0x0000AA + k);
+            sink += block[c & 127];
+        }
+    }
+    double t2 = now_ns();
+    for (int k = 0; k < passes; k++) {
+        for (int c = 0; c < cells; c++) {
+            copy_src[c & 127] = k;
+            memcpy(block, copy_src, sizeof(block));
+            sink += block[c & 127];
+        }
+    }
+    double t3 = now_ns();
+
+    double n = (double)passes * cells;
+    printf("glyph kernels: %dx%d cells\n", cell_w, cell_h);
+    printf("  1bpp expand   %8.1f ns/cell\n", (t1 - t0) / n);
+    printf("  8bpp blend    %8.1f ns/cell\n", (t2 - t1) / n);
+    printf("  copy          %8.1f ns/cell\n", (t3 - t2) / n);
+}
+
+
+//  Decode time of packed files, and the time to load them at a given read speed of the ESP
+static void bench_unpack(const char **paths, int n_paths, double mb_per_sec) {
+    const int passes = 50;
+    printf("packed files: ESP read at %.0f MB/s\n", mb_per_sec);
+    for (int k = 0; k < n_paths; k++) {
+        FILE *fp = fopen(paths[k], "rb");
+        if (!fp) continue;
+        fseek(fp, 0, SEEK_END);
+        size_t packed_size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        uint8_t *packed = malloc(packed_size);
+        packed_size = fread(packed, 1, packed_size, fp);
+        fclose(fp);
+        if (packed_size < 8) continue;
+
+        size_t size = packed[4] | (packed[5] << 8) | (packed[6] << 16) | ((size_t)packed[7] << 24);
+        uint8_t *buff = malloc(size);
+        intptr_t decoded = 0;
+        double t0 = now_ns();
+        for (int i = 0; i < passes; i++) decoded = lz_decode(buff, size, packed + 8, packed_size - 8);
+        double t_decode = (now_ns() - t0) / passes;
+
+        double ns_per_byte = 1e3 / mb_per_sec;
+        double t_plain = size * ns_per_byte, t_packed = packed_size * ns_per_byte + t_decode;
+        const char *name = strrchr(paths[k], '/');
+        printf("  %-16s %7zu -> %7zu bytes%s  decode %7.1f us (%5.0f MB/s)  load %7.1f us -> %7.1f us (x%.2f)\n",
+            name ? name + 1 : paths[k], packed_size, size, decoded == (intptr_t)size ? "" : " BROKEN",
+            t_decode / 1000, size / t_decode * 1e3, t_plain / 1000, t_packed / 1000, t_plain / t_packed);
+        free(buff);
+        free(packed);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    const char *table_path = NULL, *font_path = NULL;
+    const char *packed_paths[8];
+    int n_packed = 0;
+    double mb_per_sec = 20;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-t")) {
+            table_path = argv[i + 1];
+        } else if (!strcmp(argv[i], "-f")) {
+            font_path = argv[i + 1];
+        } else if (!strcmp(argv[i], "-z") && n_packed < 8) {
+            packed_paths[n_packed++] = argv[i + 1];
+        } else if (!strcmp(argv[i], "-b")) {
+            mb_per_sec = atof(argv[i + 1]);
+        }
+    }
+
+    if (n_packed) bench_unpack(packed_paths, n_packed, mb_per_sec);
+    bench_glyph_kernels();
+
+    if (table_path) {
+        base_and_size table;
+        if (!load_file(table_path, &table)) {
+            fprintf(stderr, "can't read %s\n", table_path);
+            return 1;
+        }
+        bench_uni2ansi("built-in", table.base);
+        if (EFI_ERROR(cp932_tbl_init(table))) {
+            fprintf(stderr, "cp932_tbl_init failed\n");
+            return 1;
+        }
+        bench_uni2ansi("CP932.BIN", table.base);
+    }
+
+    base_and_size font;
+    if (font_path) {
+        if (!load_file(font_path, &font)) {
+            fprintf(stderr, "can't read %s\n", font_path);
+            return 1;
+        }
+    } else {
+        font = make_cp932_font();
+    }
+
+    FILE *fp = tmpfile();
+    fwrite(font.base, 1, font.size, fp);
+    bench_font_loading(fp);
+    fclose(fp);
+
+    if (EFI_ERROR(cp932_font_init(font))) {
+        fprintf(stderr, "cp932_font_init failed\n");
+        return 1;
+    }
+
+    bench_widechar_lookup(font.base);
+
+    return 0;
+}
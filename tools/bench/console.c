@@ -0,0 +1,394 @@
+// Host console benchmarks for MEG-OS Loader
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+//
+//  ATOP, the menu and libstd run as they do in the loader, on top of a mock GOP
+//  that draws into a malloc'd frame buffer. libstd replaces printf and friends of
+//  the host, so the results are written with snprintf and write.
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "efi.h"
+#include "osldr.h"
+
+int snprintf(char* buffer, size_t n, const char* format, ...);
+int vsnprintf(char* buffer, size_t limit, const char* format, va_list args);
+
+EFI_SYSTEM_TABLE* gST;
+EFI_BOOT_SERVICES* gBS;
+EFI_RUNTIME_SERVICES* gRT;
+EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* cout;
+EFI_GRAPHICS_OUTPUT_PROTOCOL* gop;
+
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* format, ...) {
+    char buffer[256];
+    va_list list;
+    va_start(list, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, list);
+    va_end(list);
+    write(1, buffer, n);
+}
+
+
+//  EFI_GRAPHICS_OUTPUT_PROTOCOL on a plain frame buffer
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL gop;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE mode;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION info;
+    uint32_t* frame_buffer;
+} mock_gop;
+
+static EFI_STATUS EFIAPI mock_query_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, UINT32 mode, UINTN* size, EFI_GRAPHICS_OUTPUT_MODE_INFORMATION** info) {
+    mock_gop* self = (mock_gop*)This;
+    if (mode) return EFI_INVALID_PARAMETER;
+    *size = sizeof(self->info);
+    *info = &self->info;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_set_mode(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, UINT32 mode) {
+    return mode ? EFI_UNSUPPORTED : EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_blt(EFI_GRAPHICS_OUTPUT_PROTOCOL* This, EFI_GRAPHICS_OUTPUT_BLT_PIXEL* buffer, EFI_GRAPHICS_OUTPUT_BLT_OPERATION op,
+    UINTN sx, UINTN sy, UINTN dx, UINTN dy, UINTN w, UINTN h, UINTN delta
+) {
+    mock_gop* self = (mock_gop*)This;
+    uint32_t* fb = self->frame_buffer;
+    uint32_t* blt = (uint32_t*)buffer;
+    UINTN ppl = self->info.PixelsPerScanLine;
+    if (!delta) delta = w * sizeof(uint32_t);
+    delta /= sizeof(uint32_t);
+
+    switch (op) {
+    case EfiBltVideoFill:
+        for (UINTN y = 0; y < h; y++) {
+            uint32_t* p = fb + (dy + y) * ppl + dx;
+            for (UINTN x = 0; x < w; x++) p[x] = blt[0];
+        }
+        break;
+    case EfiBltBufferToVideo:
+        for (UINTN y = 0; y < h; y++) {
+            memmove(fb + (dy + y) * ppl + dx, blt + (sy + y) * delta + sx, w * sizeof(uint32_t));
+        }
+        break;
+    case EfiBltVideoToBltBuffer:
+        for (UINTN y = 0; y < h; y++) {
+            memmove(blt + (dy + y) * delta + dx, fb + (sy + y) * ppl + sx, w * sizeof(uint32_t));
+        }
+        break;
+    case EfiBltVideoToVideo:
+        if (dy <= sy) {
+            for (UINTN y = 0; y < h; y++) {
+                memmove(fb + (dy + y) * ppl + dx, fb + (sy + y) * ppl + sx, w * sizeof(uint32_t));
+            }
+        } else {
+            for (UINTN y = h; y-- > 0; ) {
+                memmove(fb + (dy + y) * ppl + dx, fb + (sy + y) * ppl + sx, w * sizeof(uint32_t));
+            }
+        }
+        break;
+    default:
+        return EFI_INVALID_PARAMETER;
+    }
+    return EFI_SUCCESS;
+}
+
+//  Blt only hides the frame buffer from ATOP, like firmware without a linear frame buffer
+static mock_gop* mock_gop_create(int width, int height, int blt_only) {
+    mock_gop* self = calloc(1, sizeof(mock_gop));
+    int ppl = (width + 63) & ~63;
+    self->frame_buffer = calloc((size_t)ppl * height, sizeof(uint32_t));
+    self->info.HorizontalResolution = width;
+    self->info.VerticalResolution = height;
+    self->info.PixelsPerScanLine = ppl;
+    self->info.PixelFormat = blt_only ? PixelBltOnly : PixelBlueGreenRedReserved8BitPerColor;
+    self->mode.MaxMode = 1;
+    self->mode.Info = &self->info;
+    self->mode.SizeOfInfo = sizeof(self->info);
+    self->mode.FrameBufferBase = (uintptr_t)self->frame_buffer;
+    self->mode.FrameBufferSize = (size_t)ppl * height * sizeof(uint32_t);
+    self->gop.QueryMode = mock_query_mode;
+    self->gop.SetMode = mock_set_mode;
+    self->gop.Blt = mock_blt;
+    self->gop.Mode = &self->mode;
+    return self;
+}
+
+static void mock_gop_destroy(mock_gop* self) {
+    free(self->frame_buffer);
+    free(self);
+}
+
+//  FNV-1a of the visible pixels, to tell whether a change altered the output
+static uint32_t mock_gop_hash(const mock_gop* self) {
+    uint32_t hash = 2166136261u;
+    for (UINTN y = 0; y < self->info.VerticalResolution; y++) {
+        const uint32_t* p = self->frame_buffer + y * self->info.PixelsPerScanLine;
+        for (UINTN x = 0; x < self->info.HorizontalResolution; x++) {
+            hash = (hash ^ (p[x] & 0xFFFFFF)) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+
+//  Boot services and ConIn with a queue of key strokes instead of a keyboard
+static const EFI_INPUT_KEY* mock_keys;
+static int mock_key_count, mock_key_index;
+
+static EFI_STATUS EFIAPI mock_create_event(UINT32 type, EFI_TPL tpl, EFI_EVENT_NOTIFY notify, VOID* context, EFI_EVENT* event) {
+    *event = (EFI_EVENT)(uintptr_t)type;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_set_timer(EFI_EVENT event, EFI_TIMER_DELAY type, UINT64 time) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_close_event(EFI_EVENT event) {
+    return EFI_SUCCESS;
+}
+
+static EFI_TPL EFIAPI mock_raise_tpl(EFI_TPL tpl) {
+    return TPL_APPLICATION;
+}
+
+static VOID EFIAPI mock_restore_tpl(EFI_TPL tpl) {
+}
+
+static EFI_STATUS EFIAPI mock_wait_for_event(UINTN count, EFI_EVENT* events, UINTN* index) {
+    *index = 0;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_input_reset(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, BOOLEAN extended) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_read_key(EFI_SIMPLE_TEXT_INPUT_PROTOCOL* This, EFI_INPUT_KEY* key) {
+    if (mock_key_index >= mock_key_count) return EFI_NOT_READY;
+    *key = mock_keys[mock_key_index++];
+    return EFI_SUCCESS;
+}
+
+static EFI_BOOT_SERVICES mock_bs;
+static EFI_SIMPLE_TEXT_INPUT_PROTOCOL mock_conin;
+static EFI_SYSTEM_TABLE mock_st;
+
+static void mock_init() {
+    mock_bs.CreateEvent = mock_create_event;
+    mock_bs.SetTimer = mock_set_timer;
+    mock_bs.CloseEvent = mock_close_event;
+    mock_bs.RaiseTPL = mock_raise_tpl;
+    mock_bs.RestoreTPL = mock_restore_tpl;
+    mock_bs.WaitForEvent = mock_wait_for_event;
+    mock_conin.Reset = mock_input_reset;
+    mock_conin.ReadKeyStroke = mock_read_key;
+    mock_st.BootServices = &mock_bs;
+    mock_st.ConIn = &mock_conin;
+    gST = &mock_st;
+    gBS = &mock_bs;
+}
+
+static void mock_set_keys(const EFI_INPUT_KEY* keys, int count) {
+    mock_keys = keys;
+    mock_key_count = count;
+    mock_key_index = 0;
+}
+
+
+//  Repeat a step until it has run for a while, and return how many times per second it ran
+#define BENCH_MIN_TIME	200e6
+
+static double per_second(void (*step)(int), int count) {
+    int n = 0;
+    double t0 = now_ns(), t1;
+    do {
+        step(count);
+        n += count;
+        t1 = now_ns();
+    } while (t1 - t0 < BENCH_MIN_TIME);
+    return n * 1e9 / (t1 - t0);
+}
+
+static UINTN con_cols, con_rows;
+static CHAR16* text_lines[2];
+
+//  Rewrite the screen without scrolling, one line at a time.
+//  The lines alternate between two texts, so that every cell changes.
+static void glyphs_step(int count) {
+    static int phase;
+    phase ^= 1;
+    for (int row = 0; row < count; row++) {
+        cout->SetCursorPosition(cout, 0, row);
+        cout->SetAttribute(cout, (row & 7) ? 0x07 : 0x1F);
+        cout->OutputString(cout, text_lines[phase]);
+    }
+}
+
+//  New lines at the bottom of the screen, one scroll each
+static void scroll_step(int count) {
+    for (int i = 0; i < count; i++) {
+        cout->OutputString(cout, L"\r\n");
+        cout->OutputString(cout, text_lines[i & 1] + con_cols / 2);
+    }
+}
+
+static void make_text_lines() {
+    static const char sample[] = "The quick brown fox jumps over the lazy dog. 0123456789 ";
+    for (int k = 0; k < 2; k++) {
+        free(text_lines[k]);
+        text_lines[k] = malloc((con_cols + 1) * sizeof(CHAR16));
+        for (UINTN i = 0; i < con_cols; i++) {
+            text_lines[k][i] = sample[(i + k) % (sizeof(sample) - 1)];
+        }
+        //  The last column is left empty, so the line does not wrap
+        text_lines[k][con_cols - 1] = 0;
+    }
+}
+
+
+//  Time to draw the menu from a cleared screen, and to move the selection once
+static void bench_menu(double* draw_us, double* move_us) {
+    const int draws = 20, moves = 200;
+    static const EFI_INPUT_KEY esc = { 0x17, 0 };
+    static EFI_INPUT_KEY keys[201];
+
+    menu_buffer* menu = init_menu();
+    for (int i = 0; i < 12; i++) {
+        if (i == 8) menu_add_separator(menu);
+        menu_add_format(menu, i + 1, "Boot option #%d (%s)", i + 1, (i & 1) ? "PciRoot(0x0)/Pci(0x1,0x1)/Ata(0x0)" : "Shell");
+    }
+    int n_items = menu->item_count;
+
+    double t0 = now_ns();
+    for (int i = 0; i < draws; i++) {
+        mock_set_keys(&esc, 1);
+        show_menu(menu, "MEG-OS Boot Menu", "Select the boot option");
+    }
+    *draw_us = (now_ns() - t0) / draws / 1e3;
+
+    //  Down to the end and around to the first item again
+    int n_moves = moves - moves % n_items;
+    for (int i = 0; i < n_moves; i++) {
+        EFI_INPUT_KEY down = { 0x02, 0 };
+        keys[i] = down;
+    }
+    keys[n_moves] = esc;
+    menu->selected_index = 0;
+    mock_set_keys(keys, n_moves + 1);
+    t0 = now_ns();
+    show_menu(menu, "MEG-OS Boot Menu", "Select the boot option");
+    double t_moves = now_ns() - t0;
+    *move_us = (t_moves / 1e3 - *draw_us) / n_moves;
+}
+
+
+//  Displays that mirror the first one
+#define MAX_MIRRORS	3
+static int n_mirrors;
+static int mirror_errors;
+
+static void bench_console(int width, int height, int blt_only, int text_mode) {
+    mock_gop* mock = mock_gop_create(width, height, blt_only);
+    mock_gop* mirrors[MAX_MIRRORS];
+    gop = &mock->gop;
+    ATOP_init(gop, &cout);
+    mock_st.ConOut = cout;
+    for (int i = 0; i < n_mirrors; i++) {
+        mirrors[i] = mock_gop_create(width, height, blt_only);
+        ATOP_add_mirror(cout, &mirrors[i]->gop);
+    }
+    if (text_mode < 0) text_mode = cout->Mode->MaxMode - 1;
+    cout->SetMode(cout, text_mode);
+    cout->QueryMode(cout, cout->Mode->Mode, &con_cols, &con_rows);
+    make_text_lines();
+
+    char mode[8];
+    if (n_mirrors) {
+        snprintf(mode, sizeof(mode), "%s:%d", blt_only ? "blt" : "fb", n_mirrors + 1);
+    } else {
+        snprintf(mode, sizeof(mode), "%s", blt_only ? "blt" : "fb");
+    }
+    report("console %dx%d %s: %ux%u cells\n", width, height, mode, (unsigned)con_cols, (unsigned)con_rows);
+
+    //  Pixels written to the screen per second as well, since a scaled cell has scale^2 times the pixels
+    cout->ClearScreen(cout);
+    ATOP_render_stat render0, render1;
+    gop_pixel_stat pixels0, pixels1;
+    ATOP_get_render_stat(cout, &render0);
+    gop_get_pixel_stat(&pixels0);
+    double glyphs = per_second(glyphs_step, con_rows - 1) * (con_cols - 1);
+    ATOP_get_render_stat(cout, &render1);
+    gop_get_pixel_stat(&pixels1);
+    double pixels_per_glyph = (double)(pixels1.pixels - pixels0.pixels) / (uint32_t)(render1.glyphs - render0.glyphs);
+    report("  %dx%d %s glyphs/s %u\n", width, height, mode, (unsigned)glyphs);
+    report("  %dx%d %s pixels/s %u\n", width, height, mode, (unsigned)(glyphs * pixels_per_glyph));
+
+    cout->ClearScreen(cout);
+    cout->SetCursorPosition(cout, 0, con_rows - 1);
+    double scrolls = per_second(scroll_step, 16);
+    report("  %dx%d %s scrolls/s %u\n", width, height, mode, (unsigned)scrolls);
+
+    double draw_us, move_us;
+    bench_menu(&draw_us, &move_us);
+    report("  %dx%d %s menu_draw_ns %u\n", width, height, mode, (unsigned)(draw_us * 1e3));
+    report("  %dx%d %s menu_move_ns %u\n", width, height, mode, (unsigned)(move_us * 1e3));
+    uint32_t hash = mock_gop_hash(mock);
+    report("  %dx%d %s hash %08x\n", width, height, mode, hash);
+
+    for (int i = 0; i < n_mirrors; i++) {
+        if (mock_gop_hash(mirrors[i]) != hash) {
+            report("  display %d differs from the first one\n", i + 2);
+            mirror_errors++;
+        }
+        mock_gop_destroy(mirrors[i]);
+    }
+    mock_gop_destroy(mock);
+}
+
+
+int main(int argc, char** argv) {
+    static const int default_sizes[][2] = { { 800, 600 }, { 1920, 1080 }, { 3840, 2160 } };
+    int sizes[8][2], n_sizes = 0;
+    int blt = 1, text_mode = -1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc && n_sizes < 8) {
+            char* p;
+            sizes[n_sizes][0] = strtol(argv[++i], &p, 10);
+            sizes[n_sizes][1] = (*p == 'x') ? strtol(p + 1, NULL, 10) : 0;
+            if (sizes[n_sizes][0] > 0 && sizes[n_sizes][1] > 0) n_sizes++;
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            text_mode = strtol(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            //  Number of displays
+            n_mirrors = strtol(argv[++i], NULL, 10) - 1;
+            if (n_mirrors < 0) n_mirrors = 0;
+            if (n_mirrors > MAX_MIRRORS) n_mirrors = MAX_MIRRORS;
+        } else if (!strcmp(argv[i], "-n")) {
+            //  Frame buffer only
+            blt = 0;
+        }
+    }
+    if (!n_sizes) {
+        n_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+
+    mock_init();
+    for (int i = 0; i < n_sizes; i++) {
+        bench_console(sizes[i][0], sizes[i][1], 0, text_mode);
+        if (blt) bench_console(sizes[i][0], sizes[i][1], 1, text_mode);
+    }
+
+    return mirror_errors ? 1 : 0;
+}
@@ -0,0 +1,321 @@
+// Host tests and benchmarks of the memory and string functions of libstd
+// Copyright (c) 2018 MEG-OS project, All rights reserved.
+// License: MIT
+//
+//  libstd replaces the functions of the host C library, as console.c has it.
+//  Every function is checked against a byte loop over sizes, alignments and overlaps,
+//  with a guard page after the buffers to catch reads past the end, then timed.
+//  console_write is checked on malformed UTF-8 through a mock OutputString.
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "efi.h"
+
+int snprintf(char* buffer, size_t n, const char* format, ...);
+int vsnprintf(char* buffer, size_t limit, const char* format, va_list args);
+int console_write(const char* s, size_t n);
+
+EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* cout;
+
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* format, ...) {
+    char buffer[256];
+    va_list list;
+    va_start(list, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, list);
+    va_end(list);
+    write(1, buffer, n);
+}
+
+
+//  One byte per iteration, volatile so the compiler can't make calls to libstd of them
+static void ref_memcpy(void* p, const void* q, size_t n) {
+    volatile uint8_t* _p = p;
+    const volatile uint8_t* _q = q;
+    for (size_t i = 0; i < n; i++) _p[i] = _q[i];
+}
+
+static void ref_memmove(void* p, const void* q, size_t n) {
+    volatile uint8_t* _p = p;
+    const volatile uint8_t* _q = q;
+    if (_p < _q) {
+        for (size_t i = 0; i < n; i++) _p[i] = _q[i];
+    } else {
+        for (size_t i = n; i > 0; i--) _p[i - 1] = _q[i - 1];
+    }
+}
+
+static void ref_memset(void* p, int v, size_t n) {
+    volatile uint8_t* _p = p;
+    for (size_t i = 0; i < n; i++) _p[i] = v;
+}
+
+static int ref_memcmp(const void* p, const void* q, size_t n) {
+    const volatile uint8_t* _p = p;
+    const volatile uint8_t* _q = q;
+    for (size_t i = 0; i < n; i++) {
+        if (_p[i] != _q[i]) return _p[i] - _q[i];
+    }
+    return 0;
+}
+
+static const void* ref_memchr(const void* p, int c, size_t n) {
+    const volatile uint8_t* _p = p;
+    for (size_t i = 0; i < n; i++) {
+        if (_p[i] == (uint8_t)c) return (const void*)(_p + i);
+    }
+    return NULL;
+}
+
+static size_t ref_strlen(const char* s) {
+    const volatile char* p = s;
+    size_t n = 0;
+    while (p[n]) n++;
+    return n;
+}
+
+
+#define PAGE_SIZE	4096
+#define ARENA_SIZE	(PAGE_SIZE * 512)
+
+//  Buffers that end right before a page with no access
+static uint8_t* arena_alloc() {
+    uint8_t* p = mmap(NULL, ARENA_SIZE + PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    mprotect(p + ARENA_SIZE, PAGE_SIZE, PROT_NONE);
+    return p;
+}
+
+static uint8_t *arena_a, *arena_b, *arena_c;
+static int failures;
+
+static void fail(const char* func, size_t n, int a, int b) {
+    if (failures++ < 16) report("FAIL %s n=%zu (%d, %d)\n", func, n, a, b);
+}
+
+static void fill_pattern(uint8_t* p, size_t n, unsigned seed) {
+    for (size_t i = 0; i < n; i++) p[i] = (uint8_t)(seed + i * 131 + (i >> 8));
+}
+
+#define MAX_TEST_SIZE	300
+#define MAX_ALIGN	32
+#define TEST_AREA	(MAX_TEST_SIZE + 2 * MAX_ALIGN + 64)
+
+static void test_copies() {
+    uint8_t *src = arena_a, *dst = arena_b, *ref = arena_c;
+    fill_pattern(src, TEST_AREA, 1);
+    for (size_t n = 0; n <= MAX_TEST_SIZE; n++) {
+        for (int so = 0; so < MAX_ALIGN; so++) {
+            for (int dof = 0; dof < MAX_ALIGN; dof += 3) {
+                memset(dst, 0xEE, TEST_AREA);
+                ref_memset(ref, 0xEE, TEST_AREA);
+                ref_memcpy(ref + dof, src + so, n);
+                if (memcpy(dst + dof, src + so, n) != dst + dof || ref_memcmp(dst, ref, TEST_AREA)) fail("memcpy", n, so, dof);
+
+                ref_memset(ref + dof, n + so, n);
+                if (memset(dst + dof, n + so, n) != dst + dof || ref_memcmp(dst, ref, TEST_AREA)) fail("memset", n, so, dof);
+            }
+        }
+    }
+}
+
+static void test_memmove() {
+    uint8_t *buf = arena_b, *ref = arena_c;
+    for (size_t n = 0; n <= MAX_TEST_SIZE; n++) {
+        for (int base = 0; base < 16; base += 5) {
+            for (int delta = -40; delta <= 40; delta++) {
+                int so = 48 + base, dof = so + delta;
+                fill_pattern(buf, TEST_AREA, n);
+                fill_pattern(ref, TEST_AREA, n);
+                ref_memmove(ref + dof, ref + so, n);
+                if (memmove(buf + dof, buf + so, n) != buf + dof || ref_memcmp(buf, ref, TEST_AREA)) fail("memmove", n, so, dof);
+            }
+        }
+    }
+}
+
+static int sign_of(int v) {
+    return (v > 0) - (v < 0);
+}
+
+static void test_memcmp() {
+    for (size_t n = 0; n <= MAX_TEST_SIZE; n++) {
+        for (int so = 0; so < MAX_ALIGN; so += 3) {
+            //  The second block ends at the guard page
+            uint8_t *p = arena_a + so, *q = arena_b + ARENA_SIZE - n;
+            fill_pattern(p, n, 7);
+            fill_pattern(q, n, 7);
+            if (memcmp(p, q, n)) fail("memcmp", n, so, -1);
+            for (size_t i = 0; i < n; i++) {
+                uint8_t save = q[i];
+                for (int d = -1; d <= 1; d += 2) {
+                    q[i] = save + d * ((i & 1) ? 1 : 0x80);
+                    if (sign_of(memcmp(p, q, n)) != sign_of(ref_memcmp(p, q, n))) fail("memcmp", n, so, i);
+                }
+                q[i] = save;
+            }
+        }
+    }
+}
+
+static void test_memchr() {
+    for (size_t n = 0; n <= MAX_TEST_SIZE; n++) {
+        uint8_t* p = arena_a + ARENA_SIZE - n;
+        ref_memset(p, 0x01, n);
+        if (memchr(p, 0, n) || memchr(p, 0x101, n) != ref_memchr(p, 0x101, n)) fail("memchr", n, -1, 0);
+        for (size_t i = 0; i < n; i++) {
+            static const uint8_t chars[] = { 0x00, 0x80, 0xFF, 0x02 };
+            for (int j = 0; j < 4; j++) {
+                p[i] = chars[j];
+                //  A match after the first one must not be taken
+                if (i + 3 < n) p[i + 3] = chars[j];
+                if (memchr(p, chars[j], n) != p + i) fail("memchr", n, i, chars[j]);
+                if (memchr(p, chars[j], i) != NULL) fail("memchr", i, i, chars[j]);
+                p[i] = 0x01;
+                if (i + 3 < n) p[i + 3] = 0x01;
+            }
+        }
+    }
+}
+
+static void test_strlen() {
+    for (size_t n = 0; n <= MAX_TEST_SIZE; n++) {
+        //  The terminator is the last byte before the guard page
+        char* s = (char*)arena_a + ARENA_SIZE - n - 1;
+        ref_memset(s, 0x80 + (n & 0x7F), n);
+        s[n] = 0;
+        if (strlen(s) != n) fail("strlen", n, 0, strlen(s));
+
+        for (int so = 0; so < MAX_ALIGN; so++) {
+            s = (char*)arena_b + 64 + so;
+            fill_pattern((uint8_t*)s, n + 64, 3);
+            for (size_t i = 0; i < n + 64; i++) {
+                if (!s[i]) s[i] = 1;
+            }
+            s[n] = 0;
+            if (strlen(s) != ref_strlen(s)) fail("strlen", n, so, strlen(s));
+        }
+    }
+}
+
+
+//  What console_write passed to OutputString, and the longest single string
+#define CAPTURE_SIZE	0x4000
+static CHAR16 captured[CAPTURE_SIZE];
+static size_t captured_len, longest_output;
+
+static EFI_STATUS EFIAPI capture_output_string(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL* This, CONST CHAR16* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    if (longest_output < n) longest_output = n;
+    for (size_t i = 0; i < n && captured_len < CAPTURE_SIZE; i++) captured[captured_len++] = s[i];
+    return EFI_SUCCESS;
+}
+
+static void test_console_write() {
+    static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL capture;
+    capture.OutputString = capture_output_string;
+    cout = &capture;
+
+    //  Lead bytes that never get their trail bytes, then stray trail bytes.
+    //  The first trail byte completes the last lead byte, U+00C0
+    enum { RUN = 3000 };
+    static char text[RUN * 2 + 1];
+    memset(text, 0xC3, RUN);
+    memset(text + RUN, 0x80, RUN);
+    text[RUN * 2] = '\n';
+    console_write(text, sizeof(text));
+
+    size_t expected = (RUN - 1) + 1 + (RUN - 1) + 2;
+    if (captured_len != expected) fail("console_write", sizeof(text), captured_len, expected);
+    for (size_t i = 0; i < captured_len && i < expected; i++) {
+        CHAR16 ch = (i == RUN - 1) ? 0xC0 : (i == expected - 2) ? '\r' : (i == expected - 1) ? '\n' : '?';
+        if (captured[i] != ch) {
+            fail("console_write", i, captured[i], ch);
+            break;
+        }
+    }
+    //  console_buffer holds 0x200 units with the terminator
+    if (longest_output >= 0x200) fail("console_write", longest_output, 0, 0x200);
+    cout = NULL;
+}
+
+
+#define BENCH_MIN_TIME	100e6
+
+static volatile size_t bench_sink;
+
+//  MB/s of op over n bytes, run for BENCH_MIN_TIME
+static unsigned bench_rate(int op, size_t n, int bytewise) {
+    uint8_t *p = arena_a, *q = arena_b;
+    ref_memset(p, 'a', n + 1);
+    ref_memset(q, 'a', n + 1);
+    p[n] = 0;
+
+    int count = 0;
+    double t0 = now_ns(), t1;
+    do {
+        for (int i = 0; i < 16; i++, count++) {
+            switch (op) {
+            case 0:
+                bytewise ? ref_memcpy(q, p, n) : (void)memcpy(q, p, n);
+                break;
+            case 1:
+                //  Overlapping, p above q, so that it runs backward
+                bytewise ? ref_memmove(q + 1, q, n) : (void)memmove(q + 1, q, n);
+                break;
+            case 2:
+                bytewise ? ref_memset(q, i, n) : (void)memset(q, i, n);
+                break;
+            case 3:
+                bench_sink += bytewise ? ref_memcmp(p, q, n) : memcmp(p, q, n);
+                break;
+            case 4:
+                bench_sink += (size_t)(bytewise ? ref_memchr(p, 'b', n) : memchr(p, 'b', n));
+                break;
+            case 5:
+                bench_sink += bytewise ? ref_strlen((char*)p) : strlen((char*)p);
+                break;
+            }
+        }
+        t1 = now_ns();
+    } while (t1 - t0 < BENCH_MIN_TIME);
+    return (unsigned)((double)n * count * 1e3 / (t1 - t0));
+}
+
+int main(int argc, char** argv) {
+    static const char* names[] = { "memcpy", "memmove", "memset", "memcmp", "memchr", "strlen" };
+    static const size_t sizes[] = { 16, 256, 4096, 1024 * 1024 };
+    int bytewise = (argc > 1 && !strcmp(argv[1], "-b"));
+
+    arena_a = arena_alloc();
+    arena_b = arena_alloc();
+    arena_c = arena_alloc();
+    if (!arena_a || !arena_b || !arena_c) return 1;
+
+    test_copies();
+    test_memmove();
+    test_memcmp();
+    test_memchr();
+    test_strlen();
+    test_console_write();
+    report("memory tests: %d failures\n", failures);
+
+    //  -b also times the byte loops, to see what the word and vector loops gain
+    for (int op = 0; op < 6; op++) {
+        for (int i = 0; i < 4; i++) {
+            report("  %s %zu MB/s %u\n", names[op], sizes[i], bench_rate(op, sizes[i], 0));
+            if (bytewise) report("  %s %zu bytewise_MB/s %u\n", names[op], sizes[i], bench_rate(op, sizes[i], 1));
+        }
+    }
+
+    return failures ? 1 : 0;
+}